@@ -0,0 +1,339 @@
+/*
+ * Benchmark firmware. Runs the firmware's hot paths on a Cortex-M0 (a badge, or
+ * Renode via bench_m0.resc) and times them with SysTick, which counts core
+ * clocks: real cycles on a badge, instructions under the emulator.
+ *
+ * Results go out USART1 at 115200, one per line:
+ *    BENCH,<name>,<calls>,<total counts>,<counts per call>
+ * Anything else on the port (the firmware's own logging, the iprintf bench's
+ * output) doesn't start with BENCH. "make bench-m0-run" keeps just those lines
+ * in build/bench-m0/results.csv.
+ *
+ * Peripheral waits are in the numbers: a frame includes SPI. Free under the
+ * emulator, wire time on a badge. iprintf only fills its buffer, but the TXE
+ * interrupts that drain it while the batch runs count too.
+ */
+// Pulled in whole so rolloverInterpolator() and the frame state can be reached
+// without opening up led.c's interface
+#include "../Src/led.c"
+
+#include "ir_decode.h"
+#include "utilities.h"
+#include "stm32f0xx_hal.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+// rand(), only to compare rng.c against
+#include <stdlib.h>
+
+// SysTick is 24 bits, so keep each batch well under 2^24 counts
+#define BENCH_COLOR_CALLS        (256)
+#define BENCH_INTERP_CALLS       (256)
+#define BENCH_IR_FRAMES          (32)
+#define BENCH_IPRINTF_CALLS      (8)
+#define BENCH_FRAME_CALLS        (32)
+#define BENCH_RANDOM_CALLS       (256)
+#define BENCH_TIM_CALLS          (256)
+// A hue, the range BAF asks for most
+#define BENCH_RANDOM_RANGE       (256)
+
+// RC5 on the wire: start bit plus 13, half bits in TIM3 ticks (1us at 48MHz)
+#define BENCH_IR_FRAME_BITS      (14)
+#define BENCH_IR_HALF_BIT        (889)
+#define BENCH_IR_IDLE            (0xFFFF)
+#define BENCH_IR_MAX_EDGES       (BENCH_IR_FRAME_BITS * 2)
+
+struct bench_Edge {
+   uint16_t pulse;
+   uint8_t  edge;
+};
+
+static void bench_Color(void);
+static void bench_Interpolator(void);
+static void bench_IRDecode(void);
+static void bench_Iprintf(void);
+static void bench_LEDFrame(void);
+static void bench_Random(void);
+static void bench_Timers(void);
+
+static void bench_Start(void);
+static uint32_t bench_Stop(void);
+static void bench_Report(char *name, uint32_t calls, uint32_t counts);
+static uint8_t bench_IREdges(uint16_t raw, struct bench_Edge *edges);
+
+// Start/Stop with nothing in between, taken off every batch
+static uint32_t Overhead;
+
+int main(void) {
+   HAL_Init();
+   platformHW_Init();
+
+   led_Init();
+   led_StartAnimation();
+   ir_InitDecode();
+
+   // Time nothing a few times, and keep the quickest
+   Overhead = UINT32_MAX;
+   for(int i = 0; i < 4; i++) {
+      bench_Start();
+      Overhead = MIN(Overhead, bench_Stop());
+   }
+
+   iprintf("\r\nBENCH,clock,1,%d,%d\r\n", (int)SystemCoreClock, (int)SystemCoreClock);
+   iprintf_Flush();
+
+   bench_Color();
+   bench_Interpolator();
+   bench_IRDecode();
+   bench_Iprintf();
+   bench_LEDFrame();
+   bench_Random();
+   bench_Timers();
+
+   iprintf("BENCH,done,0,0,0\r\n");
+
+   while(1) {
+   }
+}
+
+static void bench_Color(void) {
+   struct color_ColorHSV hsv = {.h = 0, .s = 100, .v = 100};
+   struct color_ColorRGB rgb;
+   uint32_t counts;
+
+   // Every hue sector, plus the grey shortcut now and then
+   bench_Start();
+   for(uint32_t i = 0; i < BENCH_COLOR_CALLS; i++) {
+      hsv.h = i;
+      hsv.s = (i & 0x1F) ? 100 : 0;
+      color_HSV2RGB(&hsv, &rgb);
+   }
+   counts = bench_Stop();
+
+   bench_Report("color_HSV2RGB", BENCH_COLOR_CALLS, counts);
+}
+
+static void bench_Interpolator(void) {
+   static yabi_ChanValue const Ends[4][2] = {
+      {10, 200},     // up
+      {200, 10},     // down
+      {20, 240},     // up the short way, through 0
+      {240, 20},     // down the short way, through 255
+   };
+   volatile yabi_ChanValue sink;
+   uint32_t counts;
+
+   bench_Start();
+   for(uint32_t i = 0; i < BENCH_INTERP_CALLS; i++) {
+      sink = rolloverInterpolator(Ends[i & 3][0] + (i >> 2), Ends[i & 3][0], Ends[i & 3][1],
+            (float)(i & 0x3F) / 64);
+   }
+   counts = bench_Stop();
+   (void)sink;
+
+   bench_Report("rolloverInterpolator", BENCH_INTERP_CALLS, counts);
+}
+
+/*
+ * Whole frames, an edge at a time, the way TIM3's ISR hands them over. Each
+ * frame's edges are made just before it's timed, so only one frame's worth
+ * sits on the stack.
+ */
+static void bench_IRDecode(void) {
+   struct bench_Edge edges[BENCH_IR_MAX_EDGES];
+   uint8_t numEdges;
+   uint16_t sent;
+   uint32_t counts = 0, calls = 0;
+   uint16_t raw;
+   bool ok = true;
+
+   for(uint32_t f = 0; f < BENCH_IR_FRAMES; f++) {
+      sent = (f * 0x9E5) & 0x1FFF;
+      numEdges = bench_IREdges(sent, edges);
+      ir_ResetPacket();
+
+      bench_Start();
+      for(uint32_t e = 0; e < numEdges; e++) {
+         ir_DataSampling(edges[e].pulse, edges[e].edge);
+      }
+      counts += bench_Stop();
+      calls += numEdges;
+
+      // Make sure it was really decoding, not bailing out early
+      ok = ok && ir_GetDecoded(&raw, NULL) && raw == sent;
+   }
+
+   if(!ok) {
+      iprintf("BENCH_ERROR,ir_DataSampling didn't decode\r\n");
+   }
+   bench_Report("ir_DataSampling", calls, counts);
+   bench_Report("ir_DataSampling_frame", BENCH_IR_FRAMES, counts);
+}
+
+static void bench_Iprintf(void) {
+   uint32_t counts;
+
+   // The hottest log line there is. Few enough to fit the buffer, so nothing
+   // is dropped
+   iprintf_Flush();
+   bench_Start();
+   for(uint32_t i = 0; i < BENCH_IPRINTF_CALLS; i++) {
+      iprintf("Bias value to %d\n", (int)(i * 16));
+   }
+   counts = bench_Stop();
+
+   iprintf_Flush();
+   iprintf("\r\n");
+   bench_Report("iprintf", BENCH_IPRINTF_CALLS, counts);
+}
+
+/*
+ * Everything led_GiveTime() does when a frame is due: BAF, YABI stepping every
+ * channel, HSV to RGB and out over SPI.
+ */
+static void bench_LEDFrame(void) {
+   uint32_t systimeMS = state.lastPump;
+   uint32_t counts;
+
+   // Get everything moving
+   for(int i = 0; i < LED_CHAIN_LENGTH; i++) {
+      led_SetChannel(i, (struct color_ColorHSV){.h = i * 25, .s = 100, .v = 50});
+   }
+
+   bench_Start();
+   for(uint32_t i = 0; i < BENCH_FRAME_CALLS; i++) {
+      systimeMS += PUMP_INTERVAL_MS + 1;
+      led_GiveTime(systimeMS);
+   }
+   counts = bench_Stop();
+
+   bench_Report("led_GiveTime_frame", BENCH_FRAME_CALLS, counts);
+}
+
+/*
+ * rng_Below() against what it replaced, newlib's rand() and a divide.
+ */
+static void bench_Random(void) {
+   // Not known until run time, as from BAF, so % can't become a mask
+   volatile uint32_t range = BENCH_RANDOM_RANGE;
+   volatile uint32_t sink;
+   uint32_t counts;
+
+   srand(1);
+   bench_Start();
+   for(uint32_t i = 0; i < BENCH_RANDOM_CALLS; i++) {
+      sink = rand() % range;
+   }
+   counts = bench_Stop();
+   bench_Report("rand_mod", BENCH_RANDOM_CALLS, counts);
+
+   rng_Seed(1);
+   bench_Start();
+   for(uint32_t i = 0; i < BENCH_RANDOM_CALLS; i++) {
+      sink = rng_Below(range);
+   }
+   counts = bench_Stop();
+   bench_Report("rng_Below", BENCH_RANDOM_CALLS, counts);
+   (void)sink;
+}
+
+/*
+ * platform_hw's register level timer calls against the HAL calls they
+ * replaced in the IR interrupts. Handles of their own, with no pins set up, so
+ * the carrier never reaches the LED.
+ */
+static void bench_Timers(void) {
+   TIM_HandleTypeDef carrier = {.Instance = TIM17};
+   TIM_HandleTypeDef capture = {.Instance = TIM3};
+   volatile uint32_t sink;
+   uint32_t counts;
+
+   __HAL_RCC_TIM17_CLK_ENABLE();
+   __HAL_RCC_TIM3_CLK_ENABLE();
+
+   // A half bit's worth each: the carrier on, then off
+   bench_Start();
+   for(uint32_t i = 0; i < BENCH_TIM_CALLS; i++) {
+      HAL_TIM_PWM_Start(&carrier, TIM_CHANNEL_1);
+      HAL_TIM_PWM_Stop(&carrier, TIM_CHANNEL_1);
+   }
+   counts = bench_Stop();
+   bench_Report("HAL_TIM_PWM_Start_Stop", BENCH_TIM_CALLS, counts);
+
+   bench_Start();
+   for(uint32_t i = 0; i < BENCH_TIM_CALLS; i++) {
+      platformHW_TimPWMStart(&carrier);
+      platformHW_TimPWMStop(&carrier);
+   }
+   counts = bench_Stop();
+   bench_Report("platformHW_TimPWM_Start_Stop", BENCH_TIM_CALLS, counts);
+
+   bench_Start();
+   for(uint32_t i = 0; i < BENCH_TIM_CALLS; i++) {
+      sink = HAL_TIM_ReadCapturedValue(&capture, TIM_CHANNEL_1);
+   }
+   counts = bench_Stop();
+   bench_Report("HAL_TIM_ReadCapturedValue", BENCH_TIM_CALLS, counts);
+
+   bench_Start();
+   for(uint32_t i = 0; i < BENCH_TIM_CALLS; i++) {
+      sink = platformHW_TimCapture(&capture);
+   }
+   counts = bench_Stop();
+   bench_Report("platformHW_TimCapture", BENCH_TIM_CALLS, counts);
+   (void)sink;
+}
+
+/*
+ * SysTick free running over its whole range with no interrupt, so a batch's
+ * count is everything that ran. HAL's 1ms tick is put back afterwards.
+ */
+static void bench_Start(void) {
+   SysTick->CTRL = 0;
+   SysTick->LOAD = SysTick_LOAD_RELOAD_Msk;
+   SysTick->VAL = 0;
+   SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+}
+
+static uint32_t bench_Stop(void) {
+   uint32_t const counts = SysTick_LOAD_RELOAD_Msk - SysTick->VAL;
+
+   HAL_InitTick(TICK_INT_PRIORITY);
+   return counts;
+}
+
+static void bench_Report(char *name, uint32_t calls, uint32_t counts) {
+   counts = (counts > Overhead) ? counts - Overhead : 0;
+   iprintf("BENCH,%s,%d,%d,%d\r\n", name, (int)calls, (int)counts,
+         (int)((counts + calls / 2) / calls));
+   // Out of the way before the next batch
+   iprintf_Flush();
+}
+
+/*
+ * The receiver pin's edges for a frame sent the way ir_encode.c does it (start
+ * bit then 13 bits MSB first, 1 as space-mark, 0 as mark-space), as pulse
+ * lengths and directions: 1 rising (carrier gone), 0 falling (carrier).
+ */
+static uint8_t bench_IREdges(uint16_t raw, struct bench_Edge *edges) {
+   uint16_t const frame = raw | (1 << (BENCH_IR_FRAME_BITS - 1));
+   uint16_t pulse = BENCH_IR_IDLE;
+   bool carrier = false, mark;
+   uint8_t n = 0;
+
+   for(int i = 0; i <= BENCH_IR_FRAME_BITS * 2; i++) {
+      // and carrier off once it's all out
+      mark = (i < BENCH_IR_FRAME_BITS * 2) &&
+         ((frame >> (BENCH_IR_FRAME_BITS - 1 - i / 2)) & 1) == (i & 1);
+
+      if(mark != carrier) {
+         edges[n].pulse = pulse;
+         edges[n].edge = !mark;
+         n++;
+         carrier = mark;
+         pulse = 0;
+      }
+      pulse += BENCH_IR_HALF_BIT;
+   }
+   return n;
+}
@@ -0,0 +1,601 @@
+/*
+ * IR decoder bench. Plays receiver output edges into the real ir_decode.c (via
+ * TIM3 capture on the host HAL) and scores what comes out:
+ * - clean:     frames at the nominal half bit
+ * - jitter:    every edge moved at random, marks stretched like the receiver does
+ * - skew:      senders whose half bit is off by up to some percent
+ * - glitch:    short blips and dropouts inside and between frames
+ * - truncated: frames cut off part way through, which must never decode
+ * - recover:   a frame cut off part way, or missing its start like one that
+ *              wakes a badge from stop mode, then a clean one a burst's gap
+ *              later, which must decode: the decoder has to time the first
+ *              one out
+ * - overlap:   two senders at once, carriers merged like they are in the air
+ * - noise:     random pulses with no frame in them, which must never decode
+ *
+ * Frames carry beacons.c's check bits. For each scenario it prints how many
+ * frames came through, how many were dropped, how many decodes were wrong
+ * (false accepts), how many of those would still get past the check, and how
+ * fast the decoder went in frames per second of CPU. Same seed, same numbers, so it's a baseline for
+ * any change to the decoder. Exits non-zero if a clean frame doesn't decode,
+ * alone or after a cut off one.
+ *
+ * With -f it replays a capture instead, and lists every frame decoded. Captures
+ * are text, one edge per line: microseconds since the previous edge, then the
+ * receiver pin's level after it (1 idle, 0 carrier). '#' starts a comment.
+ * A badge built with IR_CAPTURE=1 records them this way (Inc/ir_capture.h).
+ */
+#include "host_hal.h"
+#include "host_rand.h"
+#include "platform_hw.h"
+#include "ir_decode.h"
+#include "beacons.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+
+#define NS_PER_US                (1000LL)
+#define NS_PER_S                 (1000000000LL)
+
+// The encoder's half bit, IR_HALF_BIT_PERIOD + 1 TIM16 clocks at 48MHz
+#define BENCH_HALF_BIT_NS        (888083)
+// Start bit plus the 13 the decoder hands back
+#define BENCH_FRAME_BITS         (14)
+#define BENCH_FRAME_NS           (BENCH_FRAME_BITS * 2 * BENCH_HALF_BIT_NS)
+// Quiet time either side of a trial, well past the decoder's timeout
+#define BENCH_IDLE_NS            (10000 * NS_PER_US)
+// Between the frames of a beacon burst (BEACON_TX_GAP_MS)
+#define BENCH_BURST_GAP_NS       (10000 * NS_PER_US)
+// Carrier pulses in one trial, two frames' worth plus glitches
+#define BENCH_MAX_PULSES         (64)
+// Decodes kept per trial, anything past this is wrong anyway
+#define BENCH_MAX_DECODES        (8)
+
+enum bench_Scenario {
+   BS_Clean,
+   BS_Jitter,
+   BS_Skew,
+   BS_Glitch,
+   BS_Truncated,
+   BS_Recover,
+   BS_Overlap,
+   BS_Noise,
+   BS_Count
+};
+
+static char const * const ScenarioNames[BS_Count] = {
+   "clean", "jitter", "skew", "glitch", "truncated", "recover", "overlap", "noise",
+};
+
+struct bench_Config {
+   int         trials;
+   double      jitterUS;
+   double      stretchUS;
+   double      skewPct;
+   double      glitchUS;
+   uint64_t    seed;
+   char const  *replay;
+};
+
+// Carrier on from onNS until offNS
+struct bench_Pulse {
+   int64_t     onNS;
+   int64_t     offNS;
+};
+
+struct bench_Trial {
+   struct bench_Pulse   pulses[BENCH_MAX_PULSES];
+   int                  numPulses;
+   // what was sent (and should decode), and what did
+   uint16_t             sent[2];
+   int                  numSent;
+   uint16_t             decoded[BENCH_MAX_DECODES];
+   int                  numDecoded;
+};
+
+struct bench_Result {
+   uint64_t    trials;
+   uint64_t    sent;
+   uint64_t    ok;
+   uint64_t    dropped;
+   uint64_t    falseAccepts;
+   uint64_t    falseChecked;
+   uint64_t    edges;
+   double      cpuS;
+};
+
+struct bench_State {
+   struct bench_Config  config;
+   // every trial in a scenario, made up front so only decoding gets timed
+   struct bench_Trial   *trials;
+   struct bench_Trial   *trial;
+   uint64_t             rng;
+};
+static struct bench_State bench;
+
+static void bench_Usage(char const *name);
+static void bench_Run(enum bench_Scenario scenario, struct bench_Result *result);
+static void bench_Make(enum bench_Scenario scenario);
+static void bench_AddFrame(uint16_t raw, int64_t startNS, int64_t halfBitNS, int halfBits);
+static void bench_AddPulse(int64_t onNS, int64_t offNS);
+static void bench_Distort(void);
+static void bench_Merge(void);
+static int bench_Feed(void);
+static void bench_Score(struct bench_Result *result);
+static int bench_Replay(char const *path);
+
+static double bench_CPUSeconds(void);
+static int bench_ComparePulses(void const *a, void const *b);
+
+int main(int argc, char **argv) {
+   static struct option const options[] = {
+      {"trials",  required_argument, NULL, 'n'},
+      {"jitter",  required_argument, NULL, 'j'},
+      {"stretch", required_argument, NULL, 's'},
+      {"skew",    required_argument, NULL, 'k'},
+      {"glitch",  required_argument, NULL, 'g'},
+      {"seed",    required_argument, NULL, 'z'},
+      {"file",    required_argument, NULL, 'f'},
+      {"help",    no_argument,       NULL, 'h'},
+      {NULL, 0, NULL, 0},
+   };
+   struct bench_Config * const c = &bench.config;
+   struct bench_Result result;
+   enum bench_Scenario s;
+   bool failed = false;
+   int opt;
+
+   c->trials = 20000;
+   c->jitterUS = 40;
+   c->stretchUS = 60;
+   c->skewPct = 8;
+   c->glitchUS = 150;
+   c->seed = 1;
+   c->replay = NULL;
+
+   while((opt = getopt_long(argc, argv, "n:j:s:k:g:z:f:h", options, NULL)) != -1) {
+      switch(opt) {
+         case 'n': c->trials = atoi(optarg); break;
+         case 'j': c->jitterUS = atof(optarg); break;
+         case 's': c->stretchUS = atof(optarg); break;
+         case 'k': c->skewPct = atof(optarg); break;
+         case 'g': c->glitchUS = atof(optarg); break;
+         case 'z': c->seed = strtoull(optarg, NULL, 0); break;
+         case 'f': c->replay = optarg; break;
+         case 'h':
+            bench_Usage(argv[0]);
+            return 0;
+         default:
+            bench_Usage(argv[0]);
+            return 1;
+      }
+   }
+   if(c->trials < 1) {
+      bench_Usage(argv[0]);
+      return 1;
+   }
+
+   platformHW_Init();
+   ir_InitDecode();
+   bench.trials = calloc(c->trials, sizeof(*bench.trials));
+
+   if(c->replay) {
+      return bench_Replay(c->replay);
+   }
+
+   printf("%d trials each, jitter %.0fus, stretch %.0fus, skew %.1f%%, glitches to %.0fus, seed %llu\n",
+         c->trials, c->jitterUS, c->stretchUS, c->skewPct, c->glitchUS,
+         (unsigned long long)c->seed);
+   printf("%-10s %8s %8s %8s %8s %8s %8s %12s %9s\n", "scenario", "frames", "ok",
+         "drop%", "false", "false%", "checked", "frames/cpu-s", "ns/edge");
+
+   for(s = 0; s < BS_Count; s++) {
+      bench.rng = c->seed * 0x9E3779B97F4A7C15ULL + s + 1;
+      bench_Run(s, &result);
+
+      printf("%-10s %8llu %8llu %8.3f %8llu %8.4f %8llu %12.0f %9.1f\n", ScenarioNames[s],
+            (unsigned long long)result.sent, (unsigned long long)result.ok,
+            result.sent ? 100.0 * result.dropped / result.sent : 0.0,
+            (unsigned long long)result.falseAccepts,
+            100.0 * result.falseAccepts / result.trials,
+            (unsigned long long)result.falseChecked,
+            // Frames' worth of edges, so the no-frame scenarios still get a speed
+            result.cpuS > 0 ? result.trials / result.cpuS : 0.0,
+            result.edges ? result.cpuS * NS_PER_S / result.edges : 0.0);
+
+      if((s == BS_Clean || s == BS_Recover) && (result.dropped || result.falseAccepts)) {
+         failed = true;
+      }
+   }
+
+   free(bench.trials);
+
+   if(failed) {
+      printf("FAIL: clean frames didn't all decode\n");
+   }
+   return failed ? 1 : 0;
+}
+
+static void bench_Usage(char const *name) {
+   fprintf(stderr,
+         "usage: %s [options]\n"
+         "  -n, --trials N     trials per scenario (20000)\n"
+         "  -j, --jitter US    std dev of each edge's timing error (40)\n"
+         "  -s, --stretch US   how much longer marks come out of the receiver (60)\n"
+         "  -k, --skew PCT     worst sender half bit error for the skew scenario (8)\n"
+         "  -g, --glitch US    longest glitch (150)\n"
+         "  -z, --seed N       random seed (1)\n"
+         "  -f, --file PATH    replay a capture instead, listing what decodes\n"
+         "  -h, --help         this\n",
+         name);
+}
+
+/*
+ * Run one scenario's worth of trials.
+ */
+static void bench_Run(enum bench_Scenario scenario, struct bench_Result *result) {
+   int const trials = bench.config.trials;
+   double start;
+   int i;
+
+   memset(result, 0, sizeof(*result));
+
+   for(i = 0; i < trials; i++) {
+      bench.trial = &bench.trials[i];
+      bench_Make(scenario);
+      bench_Merge();
+   }
+
+   start = bench_CPUSeconds();
+   for(i = 0; i < trials; i++) {
+      bench.trial = &bench.trials[i];
+      result->edges += bench_Feed();
+   }
+   result->cpuS = bench_CPUSeconds() - start;
+
+   for(i = 0; i < trials; i++) {
+      bench.trial = &bench.trials[i];
+      bench_Score(result);
+   }
+}
+
+/*
+ * Make up the carrier for one trial, and what ought to come out of it.
+ */
+static void bench_Make(enum bench_Scenario scenario) {
+   struct bench_Config const * const c = &bench.config;
+   struct bench_Trial * const t = bench.trial;
+   int64_t halfBitNS = BENCH_HALF_BIT_NS;
+   int64_t at, width;
+   int i, j, n;
+
+   t->numPulses = 0;
+   t->numSent = 0;
+   t->numDecoded = 0;
+   t->sent[0] = beacon_AddCheck(host_Rand(&bench.rng) & 0x1FFF);
+   t->sent[1] = beacon_AddCheck(host_Rand(&bench.rng) & 0x1FFF);
+
+   switch(scenario) {
+      case BS_Clean:
+         bench_AddFrame(t->sent[0], 0, halfBitNS, BENCH_FRAME_BITS * 2);
+         t->numSent = 1;
+         return;
+
+      case BS_Jitter:
+         bench_AddFrame(t->sent[0], 0, halfBitNS, BENCH_FRAME_BITS * 2);
+         t->numSent = 1;
+         bench_Distort();
+         return;
+
+      case BS_Skew:
+         halfBitNS *= 1 + (2 * host_Uniform(&bench.rng) - 1) * c->skewPct / 100;
+         bench_AddFrame(t->sent[0], 0, halfBitNS, BENCH_FRAME_BITS * 2);
+         t->numSent = 1;
+         bench_Distort();
+         return;
+
+      case BS_Glitch:
+         bench_AddFrame(t->sent[0], 0, halfBitNS, BENCH_FRAME_BITS * 2);
+         t->numSent = 1;
+         bench_Distort();
+
+         // Blips of carrier, or holes in it, anywhere from just before the
+         // frame to just after
+         n = 1 + host_Rand(&bench.rng) % 3;
+         for(i = 0; i < n; i++) {
+            at = (int64_t)(host_Uniform(&bench.rng) * (BENCH_FRAME_NS + 2 * halfBitNS)) - halfBitNS;
+            width = 1000 + (int64_t)(host_Uniform(&bench.rng) * c->glitchUS * NS_PER_US);
+            if(host_Rand(&bench.rng) & 1) {
+               bench_AddPulse(at, at + width);
+            }
+            else {
+               bench_AddPulse(at, -width);
+            }
+         }
+         return;
+
+      case BS_Truncated:
+         // Lose at least the last whole bit, so it can't be made whole again
+         n = 2 + host_Rand(&bench.rng) % (BENCH_FRAME_BITS * 2 - 3);
+         bench_AddFrame(t->sent[0], 0, halfBitNS, n);
+         bench_Distort();
+         return;
+
+      case BS_Recover:
+         // The same cut, or the first n half bits lost, then a whole frame
+         // once the first would have ended
+         n = 2 + host_Rand(&bench.rng) % (BENCH_FRAME_BITS * 2 - 3);
+         if(host_Rand(&bench.rng) & 1) {
+            bench_AddFrame(t->sent[1], 0, halfBitNS, n);
+         }
+         else {
+            bench_AddFrame(t->sent[1], -n * halfBitNS, halfBitNS, BENCH_FRAME_BITS * 2);
+            // The receiver was already in whatever pulse was on
+            for(i = 0, j = 0; i < t->numPulses; i++) {
+               if(t->pulses[i].onNS >= 0) {
+                  t->pulses[j++] = t->pulses[i];
+               }
+            }
+            t->numPulses = j;
+         }
+         bench_AddFrame(t->sent[0], BENCH_FRAME_NS + BENCH_BURST_GAP_NS, halfBitNS,
+               BENCH_FRAME_BITS * 2);
+         t->numSent = 1;
+         return;
+
+      case BS_Overlap:
+         // The second sender can start anywhere in the first one's frame
+         bench_AddFrame(t->sent[0], 0, halfBitNS, BENCH_FRAME_BITS * 2);
+         at = (int64_t)(host_Uniform(&bench.rng) * BENCH_FRAME_NS);
+         halfBitNS *= 1 + (2 * host_Uniform(&bench.rng) - 1) * c->skewPct / 200;
+         bench_AddFrame(t->sent[1], at, halfBitNS, BENCH_FRAME_BITS * 2);
+         t->numSent = 2;
+         bench_Distort();
+         return;
+
+      case BS_Noise:
+         // Pulses and gaps from a fraction of a half bit to several
+         at = 0;
+         for(i = 0; i < 20; i++) {
+            width = 50000 + (int64_t)(host_Uniform(&bench.rng) * 3 * halfBitNS);
+            bench_AddPulse(at, at + width);
+            at += width + 50000 + (int64_t)(host_Uniform(&bench.rng) * 3 * halfBitNS);
+         }
+         return;
+
+      default:
+         return;
+   }
+}
+
+/*
+ * Carrier for the first halfBits of a frame, the way ir_encode.c sends it: a
+ * start bit then 13 bits MSB first, 1 as space-mark, 0 as mark-space.
+ */
+static void bench_AddFrame(uint16_t raw, int64_t startNS, int64_t halfBitNS, int halfBits) {
+   uint16_t const frame = raw | (1 << (BENCH_FRAME_BITS - 1));
+   int64_t onNS = -1;
+   bool mark;
+   int i;
+
+   for(i = 0; i < halfBits; i++) {
+      mark = ((frame >> (BENCH_FRAME_BITS - 1 - i / 2)) & 1) == (i & 1);
+
+      if(mark && onNS < 0) {
+         onNS = startNS + i * halfBitNS;
+      }
+      else if(!mark && onNS >= 0) {
+         bench_AddPulse(onNS, startNS + i * halfBitNS);
+         onNS = -1;
+      }
+   }
+   if(onNS >= 0) {
+      bench_AddPulse(onNS, startNS + halfBits * halfBitNS);
+   }
+}
+
+/*
+ * A stretch of carrier, or with a negative offNS a hole -offNS long in
+ * whatever carrier is on at onNS.
+ */
+static void bench_AddPulse(int64_t onNS, int64_t offNS) {
+   struct bench_Trial * const t = bench.trial;
+
+   if(t->numPulses < BENCH_MAX_PULSES) {
+      t->pulses[t->numPulses].onNS = onNS;
+      t->pulses[t->numPulses].offNS = offNS;
+      t->numPulses++;
+   }
+}
+
+/*
+ * Move every edge a little, and stretch the marks like the receiver does.
+ */
+static void bench_Distort(void) {
+   struct bench_Config const * const c = &bench.config;
+   struct bench_Trial * const t = bench.trial;
+   int i;
+
+   for(i = 0; i < t->numPulses; i++) {
+      t->pulses[i].onNS += (int64_t)(host_Gaussian(&bench.rng) * c->jitterUS * NS_PER_US);
+      t->pulses[i].offNS += (int64_t)((host_Gaussian(&bench.rng) * c->jitterUS + c->stretchUS) * NS_PER_US);
+   }
+}
+
+/*
+ * What the receiver sees: carrier whenever any sender has it on (less any
+ * holes), as non-overlapping pulses in time order.
+ */
+static void bench_Merge(void) {
+   struct bench_Trial * const t = bench.trial;
+   struct bench_Pulse holes[BENCH_MAX_PULSES];
+   int numHoles = 0, out = 0, i, j;
+
+   for(i = 0; i < t->numPulses; i++) {
+      if(t->pulses[i].offNS < 0) {
+         holes[numHoles].onNS = t->pulses[i].onNS;
+         holes[numHoles].offNS = t->pulses[i].onNS - t->pulses[i].offNS;
+         numHoles++;
+      }
+      else if(t->pulses[i].offNS > t->pulses[i].onNS) {
+         t->pulses[out++] = t->pulses[i];
+      }
+   }
+
+   qsort(t->pulses, out, sizeof(*t->pulses), bench_ComparePulses);
+   for(i = 1, j = 0; i < out; i++) {
+      if(t->pulses[i].onNS <= t->pulses[j].offNS) {
+         if(t->pulses[i].offNS > t->pulses[j].offNS) {
+            t->pulses[j].offNS = t->pulses[i].offNS;
+         }
+      }
+      else {
+         t->pulses[++j] = t->pulses[i];
+      }
+   }
+   t->numPulses = out ? j + 1 : 0;
+
+   // Punch the holes, splitting pulses where they land in the middle
+   for(i = 0; i < numHoles; i++) {
+      for(j = 0; j < t->numPulses; j++) {
+         struct bench_Pulse * const p = &t->pulses[j];
+
+         if(holes[i].onNS <= p->onNS || holes[i].onNS >= p->offNS) {
+            continue;
+         }
+         if(holes[i].offNS < p->offNS && t->numPulses < BENCH_MAX_PULSES) {
+            memmove(p + 2, p + 1, (t->numPulses - j - 1) * sizeof(*p));
+            p[1].onNS = holes[i].offNS;
+            p[1].offNS = p->offNS;
+            t->numPulses++;
+         }
+         p->offNS = holes[i].onNS;
+         break;
+      }
+   }
+}
+
+/*
+ * Play the trial into the receiver pin, noting every frame that decodes.
+ * Returns how many edges it took.
+ */
+static int bench_Feed(void) {
+   struct bench_Trial * const t = bench.trial;
+   int64_t const baseNS = host_NowNS() + BENCH_IDLE_NS;
+   uint16_t raw;
+   int i, edges = 0;
+
+   for(i = 0; i < t->numPulses; i++) {
+      host_RunUntilNS(baseNS + t->pulses[i].onNS);
+      host_IRRxEdge(!HOST_IR_RX_IDLE);
+      host_RunUntilNS(baseNS + t->pulses[i].offNS);
+      host_IRRxEdge(HOST_IR_RX_IDLE);
+      edges += 2;
+
+      // Frames finish on an edge, and only the latest is kept
+      if(ir_GetDecoded(&raw, NULL) && t->numDecoded < BENCH_MAX_DECODES) {
+         t->decoded[t->numDecoded++] = raw;
+      }
+   }
+   host_RunForUS(BENCH_IDLE_NS / NS_PER_US);
+   if(ir_GetDecoded(&raw, NULL) && t->numDecoded < BENCH_MAX_DECODES) {
+      t->decoded[t->numDecoded++] = raw;
+   }
+
+   return edges;
+}
+
+/*
+ * Anything decoded that wasn't sent is a false accept. With two senders
+ * at once, getting either through counts.
+ */
+static void bench_Score(struct bench_Result *result) {
+   struct bench_Trial * const t = bench.trial;
+   bool heard[2] = {false, false};
+   int i, j;
+
+   result->trials++;
+   result->sent += (t->numSent > 0);
+
+   for(i = 0; i < t->numDecoded; i++) {
+      for(j = 0; j < t->numSent && (heard[j] || t->decoded[i] != t->sent[j]); j++) {
+      }
+      if(j < t->numSent) {
+         heard[j] = true;
+      }
+      else {
+         result->falseAccepts++;
+         result->falseChecked += beacon_CheckPasses(t->decoded[i]);
+      }
+   }
+
+   if(t->numSent) {
+      if(heard[0] || heard[1]) {
+         result->ok++;
+      }
+      else {
+         result->dropped++;
+      }
+   }
+}
+
+/*
+ * Play back a capture, listing what decodes and when.
+ */
+static int bench_Replay(char const *path) {
+   FILE * const f = fopen(path, "r");
+   char line[128];
+   unsigned long deltaUS;
+   unsigned level;
+   uint64_t edges = 0, frames = 0;
+   uint16_t raw;
+   RC5_Frame_TypeDef rcf;
+   double start, cpuS;
+
+   if(!f) {
+      perror(path);
+      return 1;
+   }
+
+   start = bench_CPUSeconds();
+   while(fgets(line, sizeof(line), f)) {
+      if(sscanf(line, "%lu %u", &deltaUS, &level) != 2) {
+         continue;
+      }
+
+      host_RunForUS(deltaUS);
+      host_IRRxEdge(level != 0);
+      edges++;
+
+      if(ir_GetDecoded(&raw, &rcf)) {
+         printf("%10u 0x%04x (half bit %.2fus)\n", rcf.ArrivalUS, raw, rcf.HalfBitQ4 / 16.0);
+         frames++;
+      }
+   }
+   cpuS = bench_CPUSeconds() - start;
+   fclose(f);
+
+   printf("%llu edges, %llu frames decoded in %.3fs of CPU\n", (unsigned long long)edges,
+         (unsigned long long)frames, cpuS);
+   return 0;
+}
+
+static double bench_CPUSeconds(void) {
+   struct timespec ts;
+
+   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_ComparePulses(void const *a, void const *b) {
+   int64_t const x = ((struct bench_Pulse const *)a)->onNS;
+   int64_t const y = ((struct bench_Pulse const *)b)->onNS;
+
+   return (x > y) - (x < y);
+}
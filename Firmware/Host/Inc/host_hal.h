@@ -0,0 +1,49 @@
+#ifndef HOST_HAL_H__
+#define HOST_HAL_H__
+
+/*
+ * Controls for the virtual hardware the application runs on in host builds.
+ * Time only moves when the harness says so, and timer ISRs fire in order as
+ * it does. Everything happens on the calling thread.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Clock the timers are set up against (PLL'd HSI)
+#define HOST_SYSCLK_HZ           (48000000)
+
+// The IR receiver idles high, and goes low while it sees carrier
+#define HOST_IR_RX_IDLE          (true)
+
+typedef void (*host_IRSink)(bool carrierOn, uint64_t atNS);
+
+// Power-on state for every peripheral, time back to 0
+void host_Reset(void);
+
+// Virtual time, in ns so timer periods don't round off
+uint64_t host_NowNS(void);
+void host_RunUntilNS(uint64_t untilNS);
+void host_RunForUS(uint32_t us);
+// When the next timer ISR is due, UINT64_MAX if none are running
+uint64_t host_NextEventNS(void);
+
+// IR receiver pin (edge source). Changes the level now, and fires the capture
+// ISR if the decoder is listening.
+void host_IRRxEdge(bool level);
+// IR carrier (edge sink). Called whenever our carrier turns on or off.
+void host_SetIRSink(host_IRSink sink);
+bool host_IRCarrier(void);
+
+// Everything sent out SPI (to the LEDs) since the last clear
+uint8_t const * host_SPIRecording(size_t *len);
+void host_SPIClear(void);
+
+void host_PressButton(void);
+void host_SetUID(uint8_t const uid[12]);
+
+// Let iprintf() through to stdout
+void host_SetVerbose(bool verbose);
+
+#endif//HOST_HAL_H__
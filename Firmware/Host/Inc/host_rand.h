@@ -0,0 +1,18 @@
+#ifndef HOST_RAND_H__
+#define HOST_RAND_H__
+
+/*
+ * Randomness for host harnesses (the simulated medium, made-up IR edges),
+ * separate from the firmware's own (rng.c). xorshift64*: each caller keeps its
+ * own state, seeded non-zero, so runs repeat exactly.
+ */
+
+#include <stdint.h>
+
+uint64_t host_Rand(uint64_t *state);
+// [0, 1)
+double host_Uniform(uint64_t *state);
+// Normal, mean 0 and standard deviation 1
+double host_Gaussian(uint64_t *state);
+
+#endif//HOST_RAND_H__
@@ -0,0 +1,81 @@
+#ifndef HOST_STM32F0XX_H__
+#define HOST_STM32F0XX_H__
+
+/*
+ * Stands in for the CMSIS device header in host builds. Peripherals are plain
+ * structs in host memory (see host_hal.c), with just the registers the
+ * application touches plus some bookkeeping for the virtual hardware.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define __IO                     volatile
+
+typedef struct {
+   __IO uint32_t  CR1;
+   __IO uint32_t  DIER;
+   __IO uint32_t  SR;
+   __IO uint32_t  PSC;
+   __IO uint32_t  ARR;
+   __IO uint32_t  CCR1;
+
+   // host: counting with interrupts on, when the counter last restarted from
+   // 0 (ns), and when it next hits ARR
+   bool           running;
+   uint64_t       resetNS;
+   uint64_t       updateNS;
+} TIM_TypeDef;
+
+typedef struct {
+   __IO uint32_t  IDR;
+   __IO uint32_t  ODR;
+} GPIO_TypeDef;
+
+typedef struct {
+   __IO uint32_t  CR1;
+} SPI_TypeDef;
+
+typedef struct {
+   __IO uint32_t  CR;
+   __IO uint32_t  CFGR;
+} RCC_TypeDef;
+
+typedef struct {
+   __IO uint32_t  PR;
+} EXTI_TypeDef;
+
+extern TIM_TypeDef host_TIM3;
+extern TIM_TypeDef host_TIM16;
+extern TIM_TypeDef host_TIM17;
+extern GPIO_TypeDef host_GPIOA;
+extern SPI_TypeDef host_SPI1;
+extern RCC_TypeDef host_RCC;
+extern EXTI_TypeDef host_EXTI;
+extern uint8_t host_UID[12];
+
+#define TIM3                     (&host_TIM3)
+#define TIM16                    (&host_TIM16)
+#define TIM17                    (&host_TIM17)
+#define GPIOA                    (&host_GPIOA)
+#define SPI1                     (&host_SPI1)
+#define RCC                      (&host_RCC)
+#define EXTI                     (&host_EXTI)
+#define UID_BASE                 ((uintptr_t)host_UID)
+
+// ISRs only ever run from inside host_RunForUS() and friends, never part way
+// through firmware code, so there's nothing to mask and nothing to wait for
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t primask) { (void)primask; }
+static inline void __disable_irq(void) { }
+static inline void __enable_irq(void) { }
+static inline void __WFI(void) { }
+
+#define TIM_SR_UIF               (0x0001)
+#define TIM_SR_CC1IF             (0x0002)
+
+#define RCC_CR_HSITRIM_Pos       (3U)
+#define RCC_CR_HSITRIM_Msk       (0x1FU << RCC_CR_HSITRIM_Pos)
+#define RCC_CR_HSITRIM           RCC_CR_HSITRIM_Msk
+
+#endif//HOST_STM32F0XX_H__
@@ -0,0 +1,183 @@
+#ifndef HOST_STM32F0XX_HAL_H__
+#define HOST_STM32F0XX_HAL_H__
+
+/*
+ * The slice of the STM32F0 HAL the application modules use, for host builds.
+ * Config calls are accepted and ignored, timers and pins are driven by the
+ * virtual hardware in host_hal.c.
+ */
+
+#include "stm32f0xx.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+   HAL_OK       = 0x00,
+   HAL_ERROR    = 0x01,
+   HAL_BUSY     = 0x02,
+   HAL_TIMEOUT  = 0x03,
+} HAL_StatusTypeDef;
+
+/* Tick */
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+void HAL_IncTick(void);
+void HAL_SYSTICK_IRQHandler(void);
+
+/* RCC */
+typedef struct {
+   uint32_t ClockType;
+   uint32_t SYSCLKSource;
+   uint32_t AHBCLKDivider;
+   uint32_t APB1CLKDivider;
+} RCC_ClkInitTypeDef;
+
+void HAL_RCC_GetClockConfig(RCC_ClkInitTypeDef *RCC_ClkInitStruct, uint32_t *pFLatency);
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+
+#define __HAL_RCC_HSI_CALIBRATIONVALUE_ADJUST(v) \
+   (RCC->CR = (RCC->CR & ~RCC_CR_HSITRIM) | ((uint32_t)(v) << RCC_CR_HSITRIM_Pos))
+
+/* GPIO */
+typedef enum {
+   GPIO_PIN_RESET = 0,
+   GPIO_PIN_SET,
+} GPIO_PinState;
+
+#define GPIO_PIN_0               ((uint16_t)0x0001)
+#define GPIO_PIN_6               ((uint16_t)0x0040)
+#define GPIO_PIN_7               ((uint16_t)0x0080)
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+
+#define __HAL_GPIO_EXTI_GET_IT(line)      (EXTI->PR & (line))
+#define __HAL_GPIO_EXTI_CLEAR_IT(line)    (EXTI->PR &= ~(uint32_t)(line))
+
+/* SPI */
+typedef struct {
+   SPI_TypeDef *Instance;
+} SPI_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+
+/* TIM */
+typedef struct {
+   uint32_t Prescaler;
+   uint32_t CounterMode;
+   uint32_t Period;
+   uint32_t ClockDivision;
+   uint32_t RepetitionCounter;
+   uint32_t AutoReloadPreload;
+} TIM_Base_InitTypeDef;
+
+typedef struct {
+   TIM_TypeDef          *Instance;
+   TIM_Base_InitTypeDef Init;
+} TIM_HandleTypeDef;
+
+typedef struct {
+   uint32_t ClockSource;
+   uint32_t ClockPolarity;
+   uint32_t ClockPrescaler;
+   uint32_t ClockFilter;
+} TIM_ClockConfigTypeDef;
+
+typedef struct {
+   uint32_t SlaveMode;
+   uint32_t InputTrigger;
+   uint32_t TriggerPolarity;
+   uint32_t TriggerPrescaler;
+   uint32_t TriggerFilter;
+} TIM_SlaveConfigTypeDef;
+
+typedef struct {
+   uint32_t MasterOutputTrigger;
+   uint32_t MasterSlaveMode;
+} TIM_MasterConfigTypeDef;
+
+typedef struct {
+   uint32_t ICPolarity;
+   uint32_t ICSelection;
+   uint32_t ICPrescaler;
+   uint32_t ICFilter;
+} TIM_IC_InitTypeDef;
+
+typedef struct {
+   uint32_t OCMode;
+   uint32_t Pulse;
+   uint32_t OCPolarity;
+   uint32_t OCNPolarity;
+   uint32_t OCFastMode;
+   uint32_t OCIdleState;
+   uint32_t OCNIdleState;
+} TIM_OC_InitTypeDef;
+
+typedef struct {
+   uint32_t OffStateRunMode;
+   uint32_t OffStateIDLEMode;
+   uint32_t LockLevel;
+   uint32_t DeadTime;
+   uint32_t BreakState;
+   uint32_t BreakPolarity;
+   uint32_t AutomaticOutput;
+} TIM_BreakDeadTimeConfigTypeDef;
+
+// Only ever handed back to the HAL, so the values don't matter
+#define TIM_CHANNEL_1                        (0x0000)
+#define TIM_COUNTERMODE_UP                   (0)
+#define TIM_CLOCKDIVISION_DIV1               (0)
+#define TIM_AUTORELOAD_PRELOAD_DISABLE       (0)
+#define TIM_AUTORELOAD_PRELOAD_ENABLE        (1)
+#define TIM_CLOCKSOURCE_INTERNAL             (0)
+#define TIM_SLAVEMODE_RESET                  (0)
+#define TIM_TS_TI1FP1                        (0)
+#define TIM_INPUTCHANNELPOLARITY_BOTHEDGE    (0)
+#define TIM_TRGO_RESET                       (0)
+#define TIM_MASTERSLAVEMODE_ENABLE           (0)
+#define TIM_ICSELECTION_DIRECTTI             (0)
+#define TIM_ICPSC_DIV1                       (0)
+#define TIM_OCMODE_PWM1                      (0)
+#define TIM_OCPOLARITY_HIGH                  (0)
+#define TIM_OCNPOLARITY_HIGH                 (0)
+#define TIM_OCFAST_DISABLE                   (0)
+#define TIM_OCIDLESTATE_RESET                (0)
+#define TIM_OCNIDLESTATE_RESET               (0)
+#define TIM_OSSR_DISABLE                     (0)
+#define TIM_OSSI_DISABLE                     (0)
+#define TIM_LOCKLEVEL_OFF                    (0)
+#define TIM_BREAK_DISABLE                    (0)
+#define TIM_BREAKPOLARITY_HIGH               (0)
+#define TIM_AUTOMATICOUTPUT_ENABLE           (0)
+#define TIM_AUTOMATICOUTPUT_DISABLE          (0)
+
+#define TIM_FLAG_UPDATE                      TIM_SR_UIF
+#define TIM_FLAG_CC1                         TIM_SR_CC1IF
+
+#define __HAL_TIM_GET_FLAG(h, f)             (((h)->Instance->SR & (f)) == (f))
+#define __HAL_TIM_CLEAR_FLAG(h, f)           ((h)->Instance->SR &= ~(uint32_t)(f))
+#define __HAL_TIM_CLEAR_IT(h, f)             ((h)->Instance->SR &= ~(uint32_t)(f))
+#define __HAL_TIM_ENABLE_IT(h, f)            ((h)->Instance->DIER |= (f))
+#define __HAL_TIM_GET_COUNTER(h)             host_TIMCounter((h)->Instance)
+
+uint32_t host_TIMCounter(TIM_TypeDef *tim);
+
+HAL_StatusTypeDef HAL_TIM_Base_Init(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_Base_Stop_IT(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_ConfigClockSource(TIM_HandleTypeDef *htim, TIM_ClockConfigTypeDef *sClockSourceConfig);
+HAL_StatusTypeDef HAL_TIM_IC_Init(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_IC_ConfigChannel(TIM_HandleTypeDef *htim, TIM_IC_InitTypeDef *sConfig, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIM_IC_Start_IT(TIM_HandleTypeDef *htim, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIM_IC_Stop_IT(TIM_HandleTypeDef *htim, uint32_t Channel);
+uint32_t HAL_TIM_ReadCapturedValue(TIM_HandleTypeDef *htim, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIM_SlaveConfigSynchronization(TIM_HandleTypeDef *htim, TIM_SlaveConfigTypeDef *sSlaveConfig);
+HAL_StatusTypeDef HAL_TIMEx_MasterConfigSynchronization(TIM_HandleTypeDef *htim, TIM_MasterConfigTypeDef *sMasterConfig);
+HAL_StatusTypeDef HAL_TIM_PWM_Init(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_PWM_ConfigChannel(TIM_HandleTypeDef *htim, TIM_OC_InitTypeDef *sConfig, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef *htim, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIM_PWM_Stop(TIM_HandleTypeDef *htim, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIMEx_ConfigBreakDeadTime(TIM_HandleTypeDef *htim, TIM_BreakDeadTimeConfigTypeDef *sBreakDeadTimeConfig);
+
+#endif//HOST_STM32F0XX_HAL_H__
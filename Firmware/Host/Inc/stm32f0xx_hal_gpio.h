@@ -0,0 +1,7 @@
+#ifndef HOST_STM32F0XX_HAL_GPIO_H__
+#define HOST_STM32F0XX_HAL_GPIO_H__
+
+// Everything lives in the one host HAL header
+#include "stm32f0xx_hal.h"
+
+#endif//HOST_STM32F0XX_HAL_GPIO_H__
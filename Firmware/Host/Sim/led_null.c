@@ -0,0 +1,36 @@
+/*
+ * The simulator only cares about clocks and radios, so the LEDs go nowhere.
+ * Keeps led.c (and its animation state) out of every simulated badge, and out
+ * of the IR bench's timings.
+ */
+#include "led.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+bool led_Init(void) {
+   return true;
+}
+
+bool led_StartAnimation(void) {
+   return true;
+}
+
+bool led_SetChannel(uint32_t id, struct color_ColorHSV c) {
+   return true;
+}
+
+void led_SetBiasValue(uint8_t biasValue) {
+}
+
+void led_SetBiasWeight(uint8_t biasWeight) {
+}
+
+void led_SetAnimationSpeeds(uint32_t frameTime, uint32_t transitionTime) {
+}
+
+void led_GiveTime(uint32_t systimeMS) {
+}
+
+void led_SetSlowFrames(bool slow) {
+}
@@ -0,0 +1,999 @@
+/*
+ * Crowd simulator. Runs any number of copies of the real firmware (pattern,
+ * beacons, gossip, IR coding, clock trim...) on the host HAL, talking over a
+ * simulated IR medium:
+ * - badges are scattered over a square and hear everyone within range
+ * - each frame is lost to each listener with some probability
+ * - carriers overlapping at a listener merge, just like in the air
+ * - every badge's HSI is off by a random amount, and follows its trim
+ * - nobody hears anything over their own transmission
+ *
+ * Every variable in the firmware lives in one block of memory (see badge.ld),
+ * which gets swapped out for the badge being run. Badges only run when one of
+ * their timers is due, the firmware has something scheduled or a frame has
+ * arrived, so an hour of a big crowd goes by in seconds.
+ *
+ * Reports how long the crowd takes to sync up (every pair of neighbors on the
+ * same epoch, and in phase on the interval grid), the phase error between
+ * neighbors, how busy the channel is, and how fast a button press spreads.
+ *
+ * With --merge, the badges start out as two crowds in rooms side by side,
+ * out of range of each other, and the wall comes down part way through. The
+ * second room turns on half way to that, so its epoch is clearly the younger.
+ * Then it's how long the two take to agree on one epoch and sync up as one.
+ */
+#include "host_hal.h"
+#include "host_rand.h"
+#include "platform_hw.h"
+#include "pattern.h"
+#include "ir_encode.h"
+#include "ir_decode.h"
+#include "gossip.h"
+#include "board_id.h"
+#include "rng.h"
+#include "utilities.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+
+#define NS_PER_MS                (1000000ULL)
+#define NS_PER_S                 (1000000000ULL)
+
+// Carrier to receiver output, as beacons.c expects
+#define SIM_DEMOD_DELAY_NS       (200000)
+// About one RC5 frame on the air, so overlapping pulses count as one collision
+#define SIM_FRAME_NS             (25000000)
+// Each HSI trim step moves the clock ~0.5%, from the middle of 32
+#define SIM_TRIM_STEP            (0.005)
+#define SIM_TRIM_DEFAULT         (16)
+// How often to look at everyone's clocks
+#define SIM_SAMPLE_NS            (NS_PER_S)
+// Neighbors to aim for when picking the size of the room
+#define SIM_DEFAULT_NEIGHBORS    (8)
+
+// Phase error histogram bucket tops, ms
+#define SIM_HIST_LEN             (6)
+static double const HistTopsMS[SIM_HIST_LEN] = {0.1, 1, 10, 100, 1000, INFINITY};
+
+// From badge.ld
+extern uint8_t __badge_state_start[];
+extern uint8_t __badge_state_end[];
+
+struct sim_Config {
+   int         badges;
+   double      seconds;
+   double      range;
+   double      side;
+   double      loss;
+   double      driftPct;
+   double      bootSpread;
+   double      pressAt;
+   double      mergeAt;
+   double      reportEvery;
+   double      syncMS;
+   uint64_t    seed;
+   bool        verbose;
+};
+
+struct sim_Edge {
+   uint64_t    atNS;
+   // carriers turning on (+1) or off (-1)
+   int8_t      delta;
+};
+
+struct sim_Badge {
+   // everything in the firmware, while this badge isn't running
+   uint8_t           *context;
+   double            x;
+   double            y;
+   uint16_t          *neighbors;
+   int               numNeighbors;
+   int               component;
+
+   // local ns = localAnchor + (global ns - globalAnchor) * rate
+   double            baseRate;
+   double            rate;
+   uint64_t          globalAnchor;
+   uint64_t          localAnchor;
+   uint8_t           trim;
+   uint64_t          bootNS;
+   bool              booted;
+
+   uint64_t          wakeNS;
+   int               heapPos;
+
+   // carrier edges on their way to us, in time order
+   struct sim_Edge   *rx;
+   size_t            rxHead;
+   size_t            rxLen;
+   size_t            rxCap;
+   int               rxCarriers;
+   bool              rxHeard;
+   uint64_t          collisionNS;
+
+   // the frame we're sending, and which neighbors it's going to get to
+   bool              inFrame;
+   bool              *reaches;
+   uint64_t          carrierOnNS;
+   uint64_t          lastEdgeNS;
+};
+
+struct sim_Stats {
+   uint64_t    frames;
+   uint64_t    gossipFrames;
+   uint64_t    deliveries;
+   uint64_t    lost;
+   uint64_t    collisions;
+   uint64_t    decoded;
+   // carrier on time, times how many could hear it
+   double      airNS;
+   uint64_t    wakes;
+
+   uint64_t    firstSyncNS;
+   uint64_t    syncSinceNS;
+   bool        inSync;
+
+   uint8_t     gossipMode;
+   uint64_t    gossipDoneNS;
+
+   // after the merge: the first time everyone in badge 0's group had an epoch
+   // within PATTERN_EPOCH_MATCH_MS, and in sync (as above)
+   uint64_t    mergeEpochNS;
+   uint64_t    mergeSyncNS;
+
+   double      phaseMS[SIM_HIST_LEN];
+   uint64_t    hist[SIM_HIST_LEN];
+};
+
+struct sim_State {
+   struct sim_Config    config;
+   struct sim_Stats     stats;
+
+   struct sim_Badge     *badges;
+   struct sim_Badge     *current;
+   size_t               contextSize;
+   uint8_t              *pristine;
+
+   // badges by wake time
+   int                  *heap;
+
+   uint64_t             nowNS;
+   // for the medium (host_rand.h)
+   uint64_t             rng;
+
+   // scratch for phase errors at each sample
+   double               *errors;
+   size_t               errorsCap;
+};
+static struct sim_State sim;
+
+static void sim_Usage(char const *name);
+static void sim_Place(void);
+static void sim_Connect(void);
+static void sim_Merge(void);
+static void sim_Boot(struct sim_Badge *b);
+static void sim_Run(struct sim_Badge *b);
+static void sim_Load(struct sim_Badge *b);
+static void sim_Deliver(struct sim_Badge *b, uint64_t untilNS);
+static void sim_Hear(struct sim_Badge *b);
+static void sim_Carrier(bool on, uint64_t atNS);
+static void sim_Schedule(struct sim_Badge *b, uint64_t wakeNS);
+static void sim_SetWake(struct sim_Badge *b, uint64_t wakeNS);
+static void sim_Sample(bool report);
+static void sim_Summary(double wallS);
+
+static uint64_t sim_LocalNS(struct sim_Badge const *b, uint64_t globalNS);
+static uint64_t sim_GlobalNS(struct sim_Badge const *b, uint64_t localNS);
+
+static void sim_HeapUp(int pos);
+static void sim_HeapDown(int pos);
+static void sim_HeapSwap(int a, int b);
+
+static int sim_CompareDouble(void const *a, void const *b);
+
+// Counting hooks, via the linker's --wrap
+bool __real_gossip_ShouldAdvertise(uint8_t *version, uint8_t *setting);
+bool __real_ir_GetDecoded(uint16_t *raw, RC5_Frame_TypeDef *rc5_frame);
+
+int main(int argc, char **argv) {
+   static struct option const options[] = {
+      {"badges",  required_argument, NULL, 'n'},
+      {"seconds", required_argument, NULL, 't'},
+      {"range",   required_argument, NULL, 'r'},
+      {"side",    required_argument, NULL, 's'},
+      {"loss",    required_argument, NULL, 'l'},
+      {"drift",   required_argument, NULL, 'd'},
+      {"boot",    required_argument, NULL, 'b'},
+      {"press",   required_argument, NULL, 'p'},
+      {"merge",   required_argument, NULL, 'm'},
+      {"report",  required_argument, NULL, 'e'},
+      {"sync",    required_argument, NULL, 'y'},
+      {"seed",    required_argument, NULL, 'z'},
+      {"verbose", no_argument,       NULL, 'v'},
+      {"help",    no_argument,       NULL, 'h'},
+      {NULL, 0, NULL, 0},
+   };
+   struct sim_Config * const c = &sim.config;
+   struct timespec wallStart, wallEnd;
+   uint64_t endNS, pressNS, mergeNS, sampleNS, reportNS;
+   struct sim_Badge *b;
+   int opt;
+
+   c->badges = 100;
+   c->seconds = 3600;
+   c->range = 4;
+   c->side = 0;
+   c->loss = 0.05;
+   c->driftPct = 0.5;
+   c->bootSpread = 30;
+   c->pressAt = -1;
+   c->mergeAt = -1;
+   c->reportEvery = 300;
+   c->syncMS = 10;
+   c->seed = 1;
+   c->verbose = false;
+
+   while((opt = getopt_long(argc, argv, "n:t:r:s:l:d:b:p:m:e:y:z:vh", options, NULL)) != -1) {
+      switch(opt) {
+         case 'n': c->badges = atoi(optarg); break;
+         case 't': c->seconds = atof(optarg); break;
+         case 'r': c->range = atof(optarg); break;
+         case 's': c->side = atof(optarg); break;
+         case 'l': c->loss = atof(optarg); break;
+         case 'd': c->driftPct = atof(optarg); break;
+         case 'b': c->bootSpread = atof(optarg); break;
+         case 'p': c->pressAt = atof(optarg); break;
+         case 'm': c->mergeAt = atof(optarg); break;
+         case 'e': c->reportEvery = atof(optarg); break;
+         case 'y': c->syncMS = atof(optarg); break;
+         case 'z': c->seed = strtoull(optarg, NULL, 0); break;
+         case 'v': c->verbose = true; break;
+         case 'h':
+            sim_Usage(argv[0]);
+            return 0;
+         default:
+            sim_Usage(argv[0]);
+            return 1;
+      }
+   }
+   if(c->badges < 1 || c->badges > UINT16_MAX || c->seconds <= 0 || c->range <= 0 ||
+         (c->mergeAt >= 0 && c->badges < 2)) {
+      sim_Usage(argv[0]);
+      return 1;
+   }
+   // Big enough that the average badge has a handful of neighbors. Merging,
+   // that's each crowd's room.
+   if(c->side <= 0) {
+      c->side = sqrt(((c->mergeAt >= 0) ? c->badges / 2 : c->badges) *
+            M_PI * c->range * c->range / SIM_DEFAULT_NEIGHBORS);
+   }
+
+   sim.rng = c->seed ? c->seed : 1;
+
+   // Every badge starts from the firmware as it is before anything runs
+   sim.contextSize = __badge_state_end - __badge_state_start;
+   sim.pristine = malloc(sim.contextSize);
+   memcpy(sim.pristine, __badge_state_start, sim.contextSize);
+
+   sim.badges = calloc(c->badges, sizeof(*sim.badges));
+   sim.heap = malloc(c->badges * sizeof(*sim.heap));
+   sim_Place();
+
+   printf("%d badges on a %.1fm square, %.1fm range, %.0f%% loss, %.2f%% HSI error, "
+         "%zu bytes of state each\n", c->badges, c->side, c->range, c->loss * 100,
+         c->driftPct, sim.contextSize);
+
+   endNS = (uint64_t)(c->seconds * NS_PER_S);
+   pressNS = (c->pressAt >= 0) ? (uint64_t)(c->pressAt * NS_PER_S) : UINT64_MAX;
+   mergeNS = (c->mergeAt >= 0) ? (uint64_t)(c->mergeAt * NS_PER_S) : UINT64_MAX;
+   sampleNS = SIM_SAMPLE_NS;
+   reportNS = (uint64_t)(c->reportEvery * NS_PER_S);
+
+   clock_gettime(CLOCK_MONOTONIC, &wallStart);
+
+   while(true) {
+      b = &sim.badges[sim.heap[0]];
+
+      if(sampleNS <= endNS && sampleNS <= b->wakeNS && sampleNS <= pressNS && sampleNS <= mergeNS) {
+         sim.nowNS = sampleNS;
+         sim_Sample(reportNS > 0 && (sampleNS % reportNS) == 0);
+         sampleNS += SIM_SAMPLE_NS;
+         continue;
+      }
+
+      if(pressNS <= endNS && pressNS <= b->wakeNS) {
+         sim.nowNS = pressNS;
+         pressNS = UINT64_MAX;
+
+         b = &sim.badges[0];
+         if(b->booted) {
+            sim_Load(b);
+            sim_Deliver(b, sim.nowNS);
+            host_RunUntilNS(sim_LocalNS(b, sim.nowNS));
+            host_PressButton();
+            sim_Schedule(b, sim.nowNS);
+         }
+         continue;
+      }
+
+      if(mergeNS <= endNS && mergeNS <= b->wakeNS) {
+         sim.nowNS = mergeNS;
+         mergeNS = UINT64_MAX;
+         sim_Merge();
+         continue;
+      }
+
+      if(b->wakeNS > endNS) {
+         break;
+      }
+
+      sim.nowNS = b->wakeNS;
+      sim_Run(b);
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+
+   sim.nowNS = endNS;
+   sim_Summary((wallEnd.tv_sec - wallStart.tv_sec) + (wallEnd.tv_nsec - wallStart.tv_nsec) / 1e9);
+   return 0;
+}
+
+static void sim_Usage(char const *name) {
+   fprintf(stderr,
+         "usage: %s [options]\n"
+         "  -n, --badges N     badges in the crowd (100)\n"
+         "  -t, --seconds S    simulated time (3600)\n"
+         "  -r, --range M      IR range in meters (4)\n"
+         "  -s, --side M       side of the square room, meters (sized for ~%d neighbors)\n"
+         "  -l, --loss P       chance any one listener misses a frame (0.05)\n"
+         "  -d, --drift PCT    std dev of the HSI's error, %% (0.5)\n"
+         "  -b, --boot S       badges turn on over the first S seconds (30)\n"
+         "  -p, --press S      press badge 0's button at S seconds (never)\n"
+         "  -m, --merge S      two crowds, out of range until S seconds (one crowd)\n"
+         "  -e, --report S     print the state of the crowd every S seconds (300)\n"
+         "  -y, --sync MS      phase error that counts as in sync (10)\n"
+         "  -z, --seed N       random seed (1)\n"
+         "  -v, --verbose      firmware logging, for small runs\n"
+         "  -h, --help         this\n",
+         name, SIM_DEFAULT_NEIGHBORS);
+}
+
+/*
+ * Scatter the badges, give them clocks and work out who can hear who. Merging,
+ * the second half go in their own room, far enough over that nobody hears
+ * across.
+ */
+static void sim_Place(void) {
+   struct sim_Config const * const c = &sim.config;
+   int i;
+
+   for(i = 0; i < c->badges; i++) {
+      struct sim_Badge * const b = &sim.badges[i];
+
+      b->context = malloc(sim.contextSize);
+      memcpy(b->context, sim.pristine, sim.contextSize);
+      b->x = host_Uniform(&sim.rng) * c->side;
+      b->y = host_Uniform(&sim.rng) * c->side;
+      b->baseRate = 1 + (host_Gaussian(&sim.rng) * c->driftPct / 100);
+      b->rate = b->baseRate;
+      b->trim = SIM_TRIM_DEFAULT;
+      b->bootNS = (uint64_t)(host_Uniform(&sim.rng) * c->bootSpread * NS_PER_S);
+      if(c->mergeAt >= 0 && i >= c->badges / 2) {
+         b->x += c->side + 2 * c->range;
+         b->bootNS += (uint64_t)(c->mergeAt / 2 * NS_PER_S);
+      }
+
+      b->wakeNS = b->bootNS;
+      b->heapPos = i;
+      sim.heap[i] = i;
+   }
+   for(i = c->badges / 2; i >= 0; i--) {
+      sim_HeapDown(i);
+   }
+
+   sim_Connect();
+}
+
+/*
+ * Who can hear who, from where everyone is.
+ */
+static void sim_Connect(void) {
+   struct sim_Config const * const c = &sim.config;
+   uint16_t *near = malloc(c->badges * sizeof(*near));
+   int *queue = malloc(c->badges * sizeof(*queue));
+   double dx, dy;
+   int i, j, n, head, tail;
+
+   for(i = 0; i < c->badges; i++) {
+      struct sim_Badge * const b = &sim.badges[i];
+
+      for(j = 0, n = 0; j < c->badges; j++) {
+         dx = sim.badges[j].x - b->x;
+         dy = sim.badges[j].y - b->y;
+         if(j != i && (dx * dx + dy * dy) <= c->range * c->range) {
+            near[n++] = j;
+         }
+      }
+      free(b->neighbors);
+      free(b->reaches);
+      b->numNeighbors = n;
+      b->neighbors = malloc(n * sizeof(*b->neighbors));
+      memcpy(b->neighbors, near, n * sizeof(*b->neighbors));
+      b->reaches = calloc(n, sizeof(*b->reaches));
+      b->component = -1;
+   }
+
+   // Groups that can hear each other (even second hand)
+   for(i = 0; i < c->badges; i++) {
+      if(sim.badges[i].component >= 0) {
+         continue;
+      }
+      sim.badges[i].component = i;
+      queue[0] = i;
+      for(head = 0, tail = 1; head < tail; head++) {
+         struct sim_Badge const * const b = &sim.badges[queue[head]];
+
+         for(j = 0; j < b->numNeighbors; j++) {
+            if(sim.badges[b->neighbors[j]].component < 0) {
+               sim.badges[b->neighbors[j]].component = i;
+               queue[tail++] = b->neighbors[j];
+            }
+         }
+      }
+   }
+
+   free(queue);
+   free(near);
+}
+
+/*
+ * Take the wall down: the second room moves up against the first. Nobody's
+ * part way through a frame, senders finish theirs in one go.
+ */
+static void sim_Merge(void) {
+   struct sim_Config const * const c = &sim.config;
+   int i;
+
+   for(i = c->badges / 2; i < c->badges; i++) {
+      sim.badges[i].x -= 2 * c->range;
+   }
+   sim_Connect();
+
+   printf("%6.0fs: the two crowds meet\n", (double)sim.nowNS / NS_PER_S);
+}
+
+/*
+ * Power on: everything main() does short of the LEDs.
+ */
+static void sim_Boot(struct sim_Badge *b) {
+   uint8_t uid[12];
+   int i;
+
+   for(i = 0; i < (int)sizeof(uid); i++) {
+      uid[i] = host_Rand(&sim.rng);
+   }
+
+   b->booted = true;
+   b->globalAnchor = b->bootNS;
+   b->localAnchor = 0;
+
+   sim_Load(b);
+   host_SetUID(uid);
+   platformHW_Init();
+   // The ID's random already, so it stands in for the ADC noise too
+   rng_Seed(bid_GetHash());
+   host_SetVerbose(sim.config.verbose);
+   host_SetIRSink(sim_Carrier);
+   pattern_Init();
+}
+
+/*
+ * One pass of a badge's main loop, then work out when it needs to run next.
+ */
+static void sim_Run(struct sim_Badge *b) {
+   uint8_t trim;
+   uint64_t localNS, nextNS;
+   uint32_t untilUS;
+   int i;
+
+   sim.stats.wakes++;
+
+   if(sim.config.verbose) {
+      printf("\n[%d %.6fs] ", (int)(b - sim.badges), (double)sim.nowNS / NS_PER_S);
+   }
+
+   if(!b->booted) {
+      sim_Boot(b);
+   }
+   else {
+      sim_Load(b);
+      sim_Deliver(b, sim.nowNS);
+      host_RunUntilNS(sim_LocalNS(b, sim.nowNS));
+   }
+
+   pattern_GiveTime(platformHW_GetMicros());
+
+   // Nothing else happens until a frame's out, so send all of it at once. Saves
+   // waking up every half bit.
+   while(ir_IsSending() && host_NextEventNS() != UINT64_MAX) {
+      host_RunUntilNS(host_NextEventNS());
+   }
+
+   // Trimming the HSI speeds up or slows down everything on the badge
+   trim = (RCC->CR & RCC_CR_HSITRIM) >> RCC_CR_HSITRIM_Pos;
+   if(trim != b->trim) {
+      b->localAnchor = sim_LocalNS(b, sim.nowNS);
+      b->globalAnchor = sim.nowNS;
+      b->trim = trim;
+      b->rate = b->baseRate * (1 + ((int)trim - SIM_TRIM_DEFAULT) * SIM_TRIM_STEP);
+   }
+
+   // Frame's done, so the listeners have something to decode
+   if(b->inFrame && !ir_IsSending()) {
+      b->inFrame = false;
+      for(i = 0; i < b->numNeighbors; i++) {
+         if(b->reaches[i]) {
+            sim_Schedule(&sim.badges[b->neighbors[i]], b->lastEdgeNS + SIM_DEMOD_DELAY_NS + 1000);
+         }
+      }
+   }
+
+   localNS = host_NowNS();
+   nextNS = host_NextEventNS();
+   untilUS = pattern_TimeToNextEvent(platformHW_GetMicros());
+   if(untilUS != UINT32_MAX && ((localNS / 1000) + untilUS) * 1000 < nextNS) {
+      nextNS = ((localNS / 1000) + untilUS) * 1000;
+   }
+
+   sim_SetWake(b, (nextNS == UINT64_MAX) ? UINT64_MAX : MAX(sim_GlobalNS(b, nextNS), sim.nowNS + 1));
+}
+
+/*
+ * Swap the firmware's memory over to another badge.
+ */
+static void sim_Load(struct sim_Badge *b) {
+   if(sim.current == b) {
+      return;
+   }
+   if(sim.current) {
+      memcpy(sim.current->context, __badge_state_start, sim.contextSize);
+   }
+   memcpy(__badge_state_start, b->context, sim.contextSize);
+   sim.current = b;
+}
+
+/*
+ * Play the carrier edges that have reached us into the IR receiver. Must be
+ * loaded.
+ */
+static void sim_Deliver(struct sim_Badge *b, uint64_t untilNS) {
+   uint64_t localNS;
+   bool drowned;
+
+   while(b->rxHead < b->rxLen && b->rx[b->rxHead].atNS <= untilNS) {
+      struct sim_Edge const edge = b->rx[b->rxHead++];
+
+      // Anything from before now came in while we were sending, and got
+      // drowned out by our own carrier
+      localNS = sim_LocalNS(b, edge.atNS);
+      drowned = (localNS < host_NowNS());
+      host_RunUntilNS(localNS);
+
+      b->rxCarriers += edge.delta;
+      if(edge.delta > 0 && b->rxCarriers == 2) {
+         if(!b->collisionNS || edge.atNS - b->collisionNS > SIM_FRAME_NS) {
+            sim.stats.collisions++;
+         }
+         b->collisionNS = edge.atNS;
+      }
+
+      if(!drowned) {
+         sim_Hear(b);
+      }
+   }
+
+   // Whatever's still on the air once we're done sending
+   sim_Hear(b);
+
+   if(b->rxHead == b->rxLen) {
+      b->rxHead = b->rxLen = 0;
+   }
+}
+
+/*
+ * Bring the IR receiver's output in line with what's on the air.
+ */
+static void sim_Hear(struct sim_Badge *b) {
+   if((b->rxCarriers > 0) != b->rxHeard) {
+      b->rxHeard = !b->rxHeard;
+      host_IRRxEdge(b->rxHeard ? !HOST_IR_RX_IDLE : HOST_IR_RX_IDLE);
+   }
+}
+
+/*
+ * IR sink for whichever badge is running. Sends the edge on its way to every
+ * neighbor the frame is going to reach.
+ */
+static void sim_Carrier(bool on, uint64_t atNS) {
+   struct sim_Badge * const b = sim.current;
+   uint64_t const g = sim_GlobalNS(b, atNS);
+   struct sim_Badge *n;
+   struct sim_Edge *edge;
+   size_t pos;
+   int i;
+
+   if(on && !b->inFrame) {
+      b->inFrame = true;
+      sim.stats.frames++;
+
+      for(i = 0; i < b->numNeighbors; i++) {
+         n = &sim.badges[b->neighbors[i]];
+         b->reaches[i] = n->booted && host_Uniform(&sim.rng) >= sim.config.loss;
+         if(n->booted) {
+            sim.stats.deliveries++;
+            sim.stats.lost += !b->reaches[i];
+         }
+      }
+   }
+
+   if(on) {
+      b->carrierOnNS = g;
+   }
+   else {
+      sim.stats.airNS += (double)(g - b->carrierOnNS) * b->numNeighbors;
+   }
+   b->lastEdgeNS = g;
+
+   for(i = 0; i < b->numNeighbors; i++) {
+      if(!b->reaches[i]) {
+         continue;
+      }
+
+      n = &sim.badges[b->neighbors[i]];
+      if(n->rxLen == n->rxCap) {
+         n->rxCap = n->rxCap ? n->rxCap * 2 : 64;
+         n->rx = realloc(n->rx, n->rxCap * sizeof(*n->rx));
+      }
+
+      // Senders run a whole frame ahead, so slot in among any other frame
+      // that's already on its way
+      for(pos = n->rxLen; pos > n->rxHead && n->rx[pos - 1].atNS > g + SIM_DEMOD_DELAY_NS; pos--) {
+      }
+      if(pos < n->rxLen) {
+         memmove(&n->rx[pos + 1], &n->rx[pos], (n->rxLen - pos) * sizeof(*n->rx));
+      }
+      n->rxLen++;
+
+      edge = &n->rx[pos];
+      edge->atNS = g + SIM_DEMOD_DELAY_NS;
+      edge->delta = on ? 1 : -1;
+   }
+}
+
+/*
+ * Run a badge no later than wakeNS.
+ */
+static void sim_Schedule(struct sim_Badge *b, uint64_t wakeNS) {
+   if(wakeNS < b->wakeNS) {
+      sim_SetWake(b, wakeNS);
+   }
+}
+
+static void sim_SetWake(struct sim_Badge *b, uint64_t wakeNS) {
+   b->wakeNS = wakeNS;
+   sim_HeapUp(b->heapPos);
+   sim_HeapDown(b->heapPos);
+}
+
+/*
+ * Look at every badge's clocks, and compare each pair of neighbors.
+ */
+static void sim_Sample(bool report) {
+   struct sim_Config const * const c = &sim.config;
+   struct sim_Stats * const s = &sim.stats;
+   struct pattern_Status status;
+   struct sim_Badge *b, *n;
+   double *tickNS = malloc(c->badges * sizeof(*tickNS));
+   double *epochMS = malloc(c->badges * sizeof(*epochMS));
+   double *gridRate = malloc(c->badges * sizeof(*gridRate));
+   uint16_t *intervalMS = malloc(c->badges * sizeof(*intervalMS));
+   uint8_t *mode = calloc(c->badges, sizeof(*mode));
+   size_t pairs = 0;
+   int mismatched = 0, foreign = 0, booted = 0, agree = 0, group = 0, i, j, k;
+   uint64_t localNS;
+   double interval, error, p95, epochMin = INFINITY, epochMax = -INFINITY;
+   bool inSync;
+
+   for(i = 0; i < c->badges; i++) {
+      b = &sim.badges[i];
+      if(!b->booted) {
+         continue;
+      }
+      booted++;
+
+      sim_Load(b);
+      pattern_GetStatus(&status);
+
+      // Back out the full local time of the last tick, then when that was
+      localNS = host_NowNS();
+      localNS += (int64_t)(int32_t)(status.beaconTickUS - (uint32_t)(localNS / 1000)) * 1000;
+      tickNS[i] = (double)sim_GlobalNS(b, localNS);
+      intervalMS[i] = status.beaconIntervalMS;
+      // How fast its ticks count, which is what the crowd agrees on
+      gridRate[i] = b->rate / (1 + (double)status.phaseRateUS / 1000000);
+      epochMS[i] = status.epochMS + ((sim.nowNS - tickNS[i]) * gridRate[i] / NS_PER_MS);
+      mode[i] = status.mode;
+
+      // Badges nobody can hear keep their own epoch, so only badge 0's group
+      if(b->component == sim.badges[0].component) {
+         epochMin = MIN(epochMin, epochMS[i]);
+         epochMax = MAX(epochMax, epochMS[i]);
+      }
+   }
+
+   for(i = 0; i < c->badges; i++) {
+      b = &sim.badges[i];
+      for(k = 0; b->booted && k < b->numNeighbors; k++) {
+         j = b->neighbors[k];
+         n = &sim.badges[j];
+         if(j < i || !n->booted) {
+            continue;
+         }
+
+         if(intervalMS[i] != intervalMS[j]) {
+            mismatched++;
+         }
+         if(fabs(epochMS[i] - epochMS[j]) > PATTERN_EPOCH_MATCH_MS) {
+            foreign++;
+            continue;
+         }
+
+         interval = PATTERN_INTERVAL_GRID_MS * (double)NS_PER_MS;
+         error = fmod((tickNS[i] - tickNS[j]) * (gridRate[i] + gridRate[j]) / 2, interval);
+         if(error > interval / 2) {
+            error -= interval;
+         }
+         else if(error < -interval / 2) {
+            error += interval;
+         }
+
+         if(pairs == sim.errorsCap) {
+            sim.errorsCap = sim.errorsCap ? sim.errorsCap * 2 : 1024;
+            sim.errors = realloc(sim.errors, sim.errorsCap * sizeof(*sim.errors));
+         }
+         sim.errors[pairs++] = fabs(error) / NS_PER_MS;
+      }
+   }
+
+   qsort(sim.errors, pairs, sizeof(*sim.errors), sim_CompareDouble);
+   p95 = pairs ? sim.errors[(pairs * 95) / 100] : 0;
+
+   // In sync once everyone is up, and every pair of neighbors is in one crowd
+   // and close enough in phase
+   inSync = (booted == c->badges) && !foreign && p95 <= c->syncMS;
+   if(inSync && !s->inSync) {
+      s->syncSinceNS = sim.nowNS;
+      if(!s->firstSyncNS) {
+         s->firstSyncNS = sim.nowNS;
+      }
+   }
+   s->inSync = inSync;
+
+   if(c->mergeAt >= 0 && sim.nowNS > c->mergeAt * NS_PER_S) {
+      if(booted == c->badges && epochMax - epochMin <= PATTERN_EPOCH_MATCH_MS && !s->mergeEpochNS) {
+         s->mergeEpochNS = sim.nowNS;
+      }
+      if(inSync && !s->mergeSyncNS) {
+         s->mergeSyncNS = sim.nowNS;
+      }
+   }
+
+   // Keep the latest distribution for the summary
+   memset(s->hist, 0, sizeof(s->hist));
+   for(i = 0; i < (int)pairs; i++) {
+      for(k = 0; sim.errors[i] > HistTopsMS[k]; k++) {
+      }
+      s->hist[k]++;
+   }
+   s->phaseMS[0] = pairs ? sim.errors[pairs / 2] : 0;
+   s->phaseMS[1] = pairs ? sim.errors[(pairs * 9) / 10] : 0;
+   s->phaseMS[2] = p95;
+   s->phaseMS[3] = pairs ? sim.errors[(pairs * 99) / 100] : 0;
+   s->phaseMS[4] = pairs ? sim.errors[pairs - 1] : 0;
+
+   // Has the button press made it to everyone who could have heard about it?
+   if(c->pressAt >= 0 && sim.nowNS >= c->pressAt * NS_PER_S && !s->gossipDoneNS) {
+      s->gossipMode = mode[0];
+      for(i = 0; i < c->badges; i++) {
+         b = &sim.badges[i];
+         if(b->component == sim.badges[0].component) {
+            group++;
+            agree += (b->booted && mode[i] == mode[0]);
+         }
+      }
+      if(agree == group && mode[0] != 0) {
+         s->gossipDoneNS = sim.nowNS;
+      }
+   }
+
+   if(report) {
+      printf("%6.0fs: %d up, %zu pairs in a crowd, %d on other intervals, %d other epochs "
+            "(spanning %.2fs), phase error ms p50 %.2f p90 %.2f p99 %.2f max %.2f\n",
+            (double)sim.nowNS / NS_PER_S, booted, pairs, mismatched, foreign,
+            booted ? (epochMax - epochMin) / 1000 : 0,
+            s->phaseMS[0], s->phaseMS[1], s->phaseMS[3], s->phaseMS[4]);
+   }
+
+   free(mode);
+   free(intervalMS);
+   free(epochMS);
+   free(gridRate);
+   free(tickNS);
+}
+
+static void sim_Summary(double wallS) {
+   struct sim_Config const * const c = &sim.config;
+   struct sim_Stats const * const s = &sim.stats;
+   double const seconds = (double)sim.nowNS / NS_PER_S;
+   double neighbors = 0;
+   int i;
+
+   for(i = 0; i < c->badges; i++) {
+      neighbors += sim.badges[i].numNeighbors;
+   }
+
+   printf("\n%.0fs simulated in %.2fs (%.0fx), %llu badge wakeups\n", seconds, wallS,
+         seconds / wallS, (unsigned long long)s->wakes);
+   printf("neighbors: %.1f on average\n", neighbors / c->badges);
+   printf("frames: %llu sent (%.1f per badge per minute), %llu heard, %llu lost, "
+         "%llu collided, %llu decoded\n", (unsigned long long)s->frames,
+         s->frames / (c->badges * seconds / 60), (unsigned long long)s->deliveries,
+         (unsigned long long)s->lost, (unsigned long long)s->collisions,
+         (unsigned long long)s->decoded);
+   printf("channel utilization: %.3f%% of each listener's time\n",
+         100 * s->airNS / (c->badges * (double)sim.nowNS));
+
+   if(s->firstSyncNS) {
+      printf("convergence: in sync at %.0fs", (double)s->firstSyncNS / NS_PER_S);
+      if(s->inSync) {
+         printf(", and since %.0fs\n", (double)s->syncSinceNS / NS_PER_S);
+      }
+      else {
+         printf(", but not at the end\n");
+      }
+   }
+   else {
+      printf("convergence: never in sync (p95 phase error within %.1fms)\n", c->syncMS);
+   }
+
+   printf("phase error between neighbors (ms): p50 %.3f p90 %.3f p95 %.3f p99 %.3f max %.3f\n",
+         s->phaseMS[0], s->phaseMS[1], s->phaseMS[2], s->phaseMS[3], s->phaseMS[4]);
+   printf("  ");
+   for(i = 0; i < SIM_HIST_LEN; i++) {
+      if(isinf(HistTopsMS[i])) {
+         printf(" >%g: %llu\n", HistTopsMS[i - 1], (unsigned long long)s->hist[i]);
+      }
+      else {
+         printf(" <=%g: %llu", HistTopsMS[i], (unsigned long long)s->hist[i]);
+      }
+   }
+
+   if(c->mergeAt >= 0) {
+      printf("merge: crowds met at %.0fs, ", c->mergeAt);
+      if(s->mergeEpochNS) {
+         printf("one epoch after %.0fs", (double)s->mergeEpochNS / NS_PER_S - c->mergeAt);
+      }
+      else {
+         printf("never on one epoch");
+      }
+      if(s->mergeSyncNS) {
+         printf(", in sync after %.0fs\n", (double)s->mergeSyncNS / NS_PER_S - c->mergeAt);
+      }
+      else {
+         printf(", never in sync\n");
+      }
+   }
+
+   if(c->pressAt >= 0) {
+      printf("gossip: mode %d from badge 0 at %.0fs ", s->gossipMode, c->pressAt);
+      if(s->gossipDoneNS) {
+         printf("reached its whole group after %.0fs", (double)s->gossipDoneNS / NS_PER_S - c->pressAt);
+      }
+      else {
+         printf("never reached its whole group");
+      }
+      printf(", %llu gossip frames (%.1f%% of frames)\n", (unsigned long long)s->gossipFrames,
+            s->frames ? (100.0 * s->gossipFrames / s->frames) : 0);
+   }
+   else {
+      printf("gossip: %llu frames (%.1f%% of frames)\n", (unsigned long long)s->gossipFrames,
+            s->frames ? (100.0 * s->gossipFrames / s->frames) : 0);
+   }
+}
+
+/*
+ * Converting between simulated and each badge's own time
+ */
+
+static uint64_t sim_LocalNS(struct sim_Badge const *b, uint64_t globalNS) {
+   return b->localAnchor + (uint64_t)(((double)globalNS - (double)b->globalAnchor) * b->rate);
+}
+
+static uint64_t sim_GlobalNS(struct sim_Badge const *b, uint64_t localNS) {
+   // Round up (and then some) so a wake for a local deadline is never early
+   return b->globalAnchor + (uint64_t)ceil(((double)localNS - (double)b->localAnchor) / b->rate) + 1;
+}
+
+/*
+ * Wake heap
+ */
+
+static void sim_HeapUp(int pos) {
+   int parent;
+
+   while(pos > 0) {
+      parent = (pos - 1) / 2;
+      if(sim.badges[sim.heap[parent]].wakeNS <= sim.badges[sim.heap[pos]].wakeNS) {
+         break;
+      }
+      sim_HeapSwap(pos, parent);
+      pos = parent;
+   }
+}
+
+static void sim_HeapDown(int pos) {
+   int const len = sim.config.badges;
+   int child;
+
+   while((child = pos * 2 + 1) < len) {
+      if(child + 1 < len &&
+            sim.badges[sim.heap[child + 1]].wakeNS < sim.badges[sim.heap[child]].wakeNS) {
+         child++;
+      }
+      if(sim.badges[sim.heap[pos]].wakeNS <= sim.badges[sim.heap[child]].wakeNS) {
+         break;
+      }
+      sim_HeapSwap(pos, child);
+      pos = child;
+   }
+}
+
+static void sim_HeapSwap(int a, int b) {
+   int const t = sim.heap[a];
+
+   sim.heap[a] = sim.heap[b];
+   sim.heap[b] = t;
+   sim.badges[sim.heap[a]].heapPos = a;
+   sim.badges[sim.heap[b]].heapPos = b;
+}
+
+static int sim_CompareDouble(void const *a, void const *b) {
+   double const x = *(double const *)a;
+   double const y = *(double const *)b;
+
+   return (x > y) - (x < y);
+}
+
+/*
+ * Counting what the firmware does
+ */
+
+bool __wrap_gossip_ShouldAdvertise(uint8_t *version, uint8_t *setting) {
+   bool const advertise = __real_gossip_ShouldAdvertise(version, setting);
+
+   sim.stats.gossipFrames += advertise;
+   return advertise;
+}
+
+bool __wrap_ir_GetDecoded(uint16_t *raw, RC5_Frame_TypeDef *rc5_frame) {
+   bool const decoded = __real_ir_GetDecoded(raw, rc5_frame);
+
+   sim.stats.decoded += decoded;
+   return decoded;
+}
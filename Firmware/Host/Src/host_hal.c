@@ -0,0 +1,341 @@
+/*
+ * Virtual peripherals behind the host HAL. Only what the application relies on
+ * is modeled:
+ * TIM3: counts at its prescaled rate from the last edge (slave reset mode),
+ *       captures into CCR1 on every RX edge, and flags an update both for the
+ *       reset (URS is 0) and when it first runs past ARR after one.
+ * TIM16: an update every ARR+1 counts while started.
+ * TIM17: only whether the carrier is on.
+ * SPI: a recording of every byte sent.
+ */
+#include "host_hal.h"
+#include "stm32f0xx_hal.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HOST_SPI_RECORD_LEN      (4096)
+
+// Interrupt handlers, from stm32f0xx_it.c
+void EXTI0_1_IRQHandler(void);
+void TIM16_IRQHandler(void);
+void TIM3_IRQHandler(void);
+
+TIM_TypeDef host_TIM3;
+TIM_TypeDef host_TIM16;
+TIM_TypeDef host_TIM17;
+GPIO_TypeDef host_GPIOA;
+SPI_TypeDef host_SPI1;
+RCC_TypeDef host_RCC;
+EXTI_TypeDef host_EXTI;
+uint8_t host_UID[12];
+
+struct host_State {
+   uint64_t       nowNS;
+
+   bool           carrier;
+   host_IRSink    irSink;
+
+   // allocated on first use, most harnesses never look
+   uint8_t        *spiRecord;
+   size_t         spiLen;
+};
+static struct host_State state;
+
+static uint64_t host_TIMPeriodNS(TIM_TypeDef const *tim);
+static uint64_t host_TIMTickDivNS(TIM_TypeDef const *tim);
+static void host_TIMStart(TIM_TypeDef *tim);
+static void host_SetCarrier(bool on);
+
+void host_Reset(void) {
+   free(state.spiRecord);
+   memset(&state, 0, sizeof(state));
+
+   memset(&host_TIM3, 0, sizeof(host_TIM3));
+   memset(&host_TIM16, 0, sizeof(host_TIM16));
+   memset(&host_TIM17, 0, sizeof(host_TIM17));
+   memset(&host_GPIOA, 0, sizeof(host_GPIOA));
+   memset(&host_SPI1, 0, sizeof(host_SPI1));
+   memset(&host_RCC, 0, sizeof(host_RCC));
+   memset(&host_EXTI, 0, sizeof(host_EXTI));
+
+   // HSI trim comes up in the middle
+   host_RCC.CR = 16 << RCC_CR_HSITRIM_Pos;
+   if(HOST_IR_RX_IDLE) {
+      host_GPIOA.IDR |= GPIO_PIN_6;
+   }
+}
+
+uint64_t host_NowNS(void) {
+   return state.nowNS;
+}
+
+/*
+ * Move time forward, firing each timer ISR at the moment it falls due.
+ */
+void host_RunUntilNS(uint64_t untilNS) {
+   uint64_t next;
+
+   while((next = host_NextEventNS()) <= untilNS) {
+      state.nowNS = next;
+
+      if(host_TIM16.running && host_TIM16.updateNS == next) {
+         host_TIM16.resetNS = next;
+         host_TIM16.updateNS += host_TIMPeriodNS(&host_TIM16);
+         host_TIM16.SR |= TIM_SR_UIF;
+         TIM16_IRQHandler();
+      }
+      else if(host_TIM3.running && host_TIM3.updateNS == next) {
+         // The counter wraps and carries on. The first update after an edge
+         // is the decoder's timeout, which drops a part frame; later ones find
+         // nothing to drop, so only that one is fired
+         host_TIM3.resetNS = next;
+         host_TIM3.updateNS = UINT64_MAX;
+         host_TIM3.SR |= TIM_SR_UIF;
+         TIM3_IRQHandler();
+      }
+   }
+
+   if(untilNS > state.nowNS) {
+      state.nowNS = untilNS;
+   }
+}
+
+void host_RunForUS(uint32_t us) {
+   host_RunUntilNS(state.nowNS + ((uint64_t)us * 1000));
+}
+
+uint64_t host_NextEventNS(void) {
+   uint64_t next = UINT64_MAX;
+
+   if(host_TIM16.running && host_TIM16.updateNS < next) {
+      next = host_TIM16.updateNS;
+   }
+   if(host_TIM3.running && host_TIM3.updateNS < next) {
+      next = host_TIM3.updateNS;
+   }
+   return next;
+}
+
+void host_IRRxEdge(bool level) {
+   if(level) {
+      host_GPIOA.IDR |= GPIO_PIN_6;
+   }
+   else {
+      host_GPIOA.IDR &= ~GPIO_PIN_6;
+   }
+
+   if(!host_TIM3.running) {
+      return;
+   }
+
+   // Capture how long since the last edge, then the edge resets the counter,
+   // which is an update event of its own
+   host_TIM3.CCR1 = host_TIMCounter(&host_TIM3);
+   host_TIM3.resetNS = state.nowNS;
+   host_TIM3.updateNS = state.nowNS + host_TIMPeriodNS(&host_TIM3);
+   host_TIM3.SR |= TIM_SR_CC1IF | TIM_SR_UIF;
+   TIM3_IRQHandler();
+}
+
+void host_SetIRSink(host_IRSink sink) {
+   state.irSink = sink;
+}
+
+bool host_IRCarrier(void) {
+   return state.carrier;
+}
+
+uint8_t const * host_SPIRecording(size_t *len) {
+   *len = state.spiLen;
+   return state.spiRecord;
+}
+
+void host_SPIClear(void) {
+   state.spiLen = 0;
+}
+
+void host_PressButton(void) {
+   host_GPIOA.IDR |= GPIO_PIN_0;
+   host_EXTI.PR |= GPIO_PIN_0;
+   EXTI0_1_IRQHandler();
+}
+
+void host_SetUID(uint8_t const uid[12]) {
+   memcpy(host_UID, uid, sizeof(host_UID));
+}
+
+uint32_t host_TIMCounter(TIM_TypeDef *tim) {
+   if(!tim->running) {
+      return 0;
+   }
+   return (((state.nowNS - tim->resetNS) * HOST_SYSCLK_HZ) / host_TIMTickDivNS(tim)) % (tim->ARR + 1);
+}
+
+/*
+ * HAL
+ */
+
+uint32_t HAL_GetTick(void) {
+   return (uint32_t)(state.nowNS / 1000000);
+}
+
+// Waits as long in virtual time, with everything else running meanwhile
+void HAL_Delay(uint32_t Delay) {
+   host_RunForUS(Delay * 1000);
+}
+
+// Virtual time never needs ticking along
+void HAL_IncTick(void) {
+}
+
+void HAL_SYSTICK_IRQHandler(void) {
+}
+
+void HAL_RCC_GetClockConfig(RCC_ClkInitTypeDef *RCC_ClkInitStruct, uint32_t *pFLatency) {
+   memset(RCC_ClkInitStruct, 0, sizeof(*RCC_ClkInitStruct));
+   *pFLatency = 0;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void) {
+   return HOST_SYSCLK_HZ;
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
+   return (GPIOx->IDR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState) {
+   if(PinState == GPIO_PIN_SET) {
+      GPIOx->ODR |= GPIO_Pin;
+   }
+   else {
+      GPIOx->ODR &= ~GPIO_Pin;
+   }
+
+   // PA7 is TIM17's output. Forcing it low kills the carrier.
+   if(GPIOx == GPIOA && (GPIO_Pin & GPIO_PIN_7) && PinState == GPIO_PIN_RESET) {
+      host_SetCarrier(false);
+   }
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+   size_t const room = HOST_SPI_RECORD_LEN - state.spiLen;
+   size_t const n = (Size < room) ? Size : room;
+
+   if(state.spiRecord == NULL) {
+      state.spiRecord = malloc(HOST_SPI_RECORD_LEN);
+   }
+
+   memcpy(&state.spiRecord[state.spiLen], pData, n);
+   state.spiLen += n;
+   return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Init(TIM_HandleTypeDef *htim) {
+   htim->Instance->PSC = htim->Init.Prescaler;
+   htim->Instance->ARR = htim->Init.Period;
+   return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT(TIM_HandleTypeDef *htim) {
+   // Already counting carries on where it was, like setting CEN again
+   if(!htim->Instance->running) {
+      host_TIMStart(htim->Instance);
+   }
+   return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Stop_IT(TIM_HandleTypeDef *htim) {
+   htim->Instance->running = false;
+   return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_IC_Start_IT(TIM_HandleTypeDef *htim, uint32_t Channel) {
+   host_TIMStart(htim->Instance);
+   return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_IC_Stop_IT(TIM_HandleTypeDef *htim, uint32_t Channel) {
+   htim->Instance->running = false;
+   return HAL_OK;
+}
+
+uint32_t HAL_TIM_ReadCapturedValue(TIM_HandleTypeDef *htim, uint32_t Channel) {
+   return htim->Instance->CCR1;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef *htim, uint32_t Channel) {
+   if(htim->Instance == TIM17) {
+      host_SetCarrier(true);
+   }
+   return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Stop(TIM_HandleTypeDef *htim, uint32_t Channel) {
+   if(htim->Instance == TIM17) {
+      host_SetCarrier(false);
+   }
+   return HAL_OK;
+}
+
+// Nothing to model in the rest of the setup
+HAL_StatusTypeDef HAL_TIM_ConfigClockSource(TIM_HandleTypeDef *htim, TIM_ClockConfigTypeDef *sClockSourceConfig) {
+   return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_IC_Init(TIM_HandleTypeDef *htim) {
+   return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_IC_ConfigChannel(TIM_HandleTypeDef *htim, TIM_IC_InitTypeDef *sConfig, uint32_t Channel) {
+   return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_SlaveConfigSynchronization(TIM_HandleTypeDef *htim, TIM_SlaveConfigTypeDef *sSlaveConfig) {
+   return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIMEx_MasterConfigSynchronization(TIM_HandleTypeDef *htim, TIM_MasterConfigTypeDef *sMasterConfig) {
+   return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Init(TIM_HandleTypeDef *htim) {
+   return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_ConfigChannel(TIM_HandleTypeDef *htim, TIM_OC_InitTypeDef *sConfig, uint32_t Channel) {
+   return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIMEx_ConfigBreakDeadTime(TIM_HandleTypeDef *htim, TIM_BreakDeadTimeConfigTypeDef *sBreakDeadTimeConfig) {
+   return HAL_OK;
+}
+
+// ns per count, times HOST_SYSCLK_HZ so it stays exact
+static uint64_t host_TIMTickDivNS(TIM_TypeDef const *tim) {
+   return (uint64_t)(tim->PSC + 1) * 1000000000;
+}
+
+static uint64_t host_TIMPeriodNS(TIM_TypeDef const *tim) {
+   return ((uint64_t)(tim->ARR + 1) * (tim->PSC + 1) * 1000000000) / HOST_SYSCLK_HZ;
+}
+
+static void host_TIMStart(TIM_TypeDef *tim) {
+   tim->running = true;
+   tim->resetNS = state.nowNS;
+   tim->updateNS = state.nowNS + host_TIMPeriodNS(tim);
+}
+
+static void host_SetCarrier(bool on) {
+   if(state.carrier == on) {
+      return;
+   }
+
+   state.carrier = on;
+   if(state.irSink) {
+      state.irSink(on, state.nowNS);
+   }
+}
@@ -0,0 +1,27 @@
+/*
+ * See host_rand.h. No state of its own, so the simulator's per-badge memory
+ * swapping leaves it alone.
+ */
+#include "host_rand.h"
+
+#include <stdint.h>
+#include <math.h>
+
+// xorshift64*
+uint64_t host_Rand(uint64_t *state) {
+   *state ^= *state >> 12;
+   *state ^= *state << 25;
+   *state ^= *state >> 27;
+   return *state * 0x2545F4914F6CDD1DULL;
+}
+
+double host_Uniform(uint64_t *state) {
+   return (host_Rand(state) >> 11) * (1.0 / (1ULL << 53));
+}
+
+// Box-Muller, throwing away the second one
+double host_Gaussian(uint64_t *state) {
+   double const u = 1.0 - host_Uniform(state);
+
+   return sqrt(-2 * log(u)) * cos(2 * M_PI * host_Uniform(state));
+}
@@ -0,0 +1,53 @@
+/*
+ * iprintf() walks its arguments off the stack, which only works on the badge.
+ * On the host it's plain printf, and off unless asked for.
+ */
+#include "iprintf.h"
+#include "host_hal.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+static bool Verbose = false;
+
+void iprintf(char *pszFmt,...) {
+   va_list args;
+
+   if(!Verbose) {
+      return;
+   }
+
+   va_start(args, pszFmt);
+   vprintf(pszFmt, args);
+   va_end(args);
+}
+
+void iprintf_Write(uint8_t const *data, uint16_t len) {
+   if(Verbose) {
+      fwrite(data, 1, len, stdout);
+   }
+}
+
+// Nothing's buffered on the host
+void iprintf_Flush(void) {
+}
+
+void iprintf_Blocking(bool on) {
+}
+
+uint32_t iprintf_GetDropped(void) {
+   return 0;
+}
+
+// Nothing comes in either
+bool iprintf_GetChar(uint8_t *ch) {
+   return false;
+}
+
+void iprintf_UartISR(void) {
+}
+
+void host_SetVerbose(bool verbose) {
+   Verbose = verbose;
+}
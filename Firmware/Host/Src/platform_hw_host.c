@@ -0,0 +1,86 @@
+/*
+ * platform_hw for host builds. The clock is virtual time and the LEDs go to
+ * the SPI recording.
+ */
+#include "platform_hw.h"
+#include "host_hal.h"
+#include "utilities.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+static uint8_t const LED_FRAME_START[4] = {0x00, 0x00, 0x00, 0x00};
+static uint8_t const LED_FRAME_STOP[4]  = {0xFF, 0xFF, 0xFF, 0xFF};
+
+#define LED_GLOB_BRIGHTNESS         (0x1)
+
+
+bool platformHW_Init(void) {
+   host_Reset();
+   return true;
+}
+
+bool platformHW_SpiInit(SPI_HandleTypeDef * const spi, SPI_TypeDef* spiInstance) {
+   spi->Instance = spiInstance;
+   return true;
+}
+
+/*
+ * The colors as they'd go out at full brightness, with no budget.
+ */
+void platformHW_UpdateLEDs(SPI_HandleTypeDef* spi, struct color_ColorHSV const * const leds) {
+   union platformHW_LEDRegister out = {.header = 0x7, .globalBrightness = LED_GLOB_BRIGHTNESS};
+   int i;
+
+   HAL_SPI_Transmit(spi, (uint8_t*)LED_FRAME_START, sizeof(LED_FRAME_START), 10000);
+
+   for(i = 0; i < LED_CHAIN_LENGTH; i++) {
+      color_HSV2RGB(&leds[i], &out.color);
+      HAL_SPI_Transmit(spi, out.raw, sizeof(out.raw), 10000);
+   }
+
+   HAL_SPI_Transmit(spi, (uint8_t*)LED_FRAME_STOP, sizeof(LED_FRAME_STOP), 10000);
+}
+
+// The host's timers are modelled in its HAL
+void platformHW_TimStartIT(TIM_HandleTypeDef * const tim) {
+   HAL_TIM_Base_Start_IT(tim);
+}
+
+void platformHW_TimStopIT(TIM_HandleTypeDef * const tim) {
+   HAL_TIM_Base_Stop_IT(tim);
+}
+
+void platformHW_TimPWMStart(TIM_HandleTypeDef * const tim) {
+   HAL_TIM_PWM_Start(tim, TIM_CHANNEL_1);
+}
+
+void platformHW_TimPWMStop(TIM_HandleTypeDef * const tim) {
+   HAL_TIM_PWM_Stop(tim, TIM_CHANNEL_1);
+}
+
+uint32_t platformHW_TimCapture(TIM_HandleTypeDef * const tim) {
+   return HAL_TIM_ReadCapturedValue(tim, TIM_CHANNEL_1);
+}
+
+uint32_t platformHW_GetMicros(void) {
+   return (uint32_t)(host_NowNS() / 1000);
+}
+
+// The host's stack and RAM are nothing like the badge's
+uint32_t platformHW_StackFree(void) {
+   return 0;
+}
+uint32_t platformHW_StaticRAM(void) {
+   return 0;
+}
+
+uint8_t platformHW_TrimHSI(int8_t steps) {
+   int16_t const trimMax = RCC_CR_HSITRIM_Msk >> RCC_CR_HSITRIM_Pos;
+   int16_t trim = (RCC->CR & RCC_CR_HSITRIM) >> RCC_CR_HSITRIM_Pos;
+
+   trim = MAX(0, MIN(trimMax, trim + steps));
+   __HAL_RCC_HSI_CALIBRATIONVALUE_ADJUST(trim);
+
+   return trim;
+}
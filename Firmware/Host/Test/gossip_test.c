@@ -0,0 +1,119 @@
+/*
+ * Host tests for gossip.c's version rules. Prints each failed check and exits
+ * non-zero if there were any.
+ */
+#include "gossip.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define CHECK(x) \
+   do { \
+      if(!(x)) { \
+         printf("%s:%d: %s failed\n", __FILE__, __LINE__, #x); \
+         failures++; \
+      } \
+   } while(0)
+
+static int failures;
+
+static int test_Advertisements(int beacons);
+
+/*
+ * A fresh badge takes whatever it hears first, even a version that looks
+ * behind its own, and never advertises its made-up default.
+ */
+static void test_Unset(void) {
+   uint8_t version, setting;
+
+   gossip_Init();
+   CHECK(test_Advertisements(4 * GOSSIP_VERSION_MASK) == 0);
+
+   // 20 is more than half the version space past 0, so it reads as behind
+   CHECK(gossip_Heard(20, 3));
+   CHECK(gossip_Setting() == 3);
+   CHECK(gossip_ShouldAdvertise(&version, &setting));
+   CHECK(version == 20 && setting == 3);
+
+   // Set now, so the usual rules apply
+   CHECK(!gossip_Heard(19, 1));
+   CHECK(gossip_Setting() == 3);
+
+   // Our own press sets it too
+   gossip_Init();
+   gossip_Originate(2);
+   CHECK(gossip_ShouldAdvertise(&version, &setting));
+   CHECK(setting == 2);
+}
+
+/*
+ * Newer versions win, older ones get told.
+ */
+static void test_Versions(void) {
+   uint8_t version, setting;
+
+   gossip_Init();
+   gossip_Originate(1);
+
+   CHECK(gossip_Heard(5, 2));
+   CHECK(gossip_Setting() == 2);
+
+   // Wrapped around: 1 is ahead of 30
+   CHECK(gossip_Heard(18, 3));
+   CHECK(gossip_Heard(30, 3));
+   CHECK(gossip_Heard(1, 1));
+   CHECK(gossip_Setting() == 1);
+
+   CHECK(!gossip_Heard(0, 3));
+   CHECK(gossip_Setting() == 1);
+   CHECK(gossip_ShouldAdvertise(&version, &setting));
+   CHECK(version == 1 && setting == 1);
+}
+
+/*
+ * Two presses on the same version: everyone ends up on the higher setting,
+ * whichever they heard first.
+ */
+static void test_Tie(void) {
+   uint8_t version, setting;
+
+   gossip_Init();
+   gossip_Originate(1);
+   CHECK(gossip_Heard(1, 2));
+   CHECK(gossip_Setting() == 2);
+
+   gossip_Init();
+   gossip_Originate(2);
+   CHECK(!gossip_Heard(1, 1));
+   CHECK(gossip_Setting() == 2);
+   // and the loser hears about it
+   CHECK(gossip_ShouldAdvertise(&version, &setting));
+   CHECK(version == 1 && setting == 2);
+
+   // Agreeing is what quiets us down
+   gossip_Init();
+   gossip_Originate(2);
+   CHECK(!gossip_Heard(1, 2));
+   CHECK(!gossip_Heard(1, 2));
+   CHECK(test_Advertisements(1) == 0);
+}
+
+int main(void) {
+   test_Unset();
+   test_Versions();
+   test_Tie();
+
+   printf("gossip: %s\n", failures ? "FAILED" : "ok");
+   return failures ? 1 : 0;
+}
+
+static int test_Advertisements(int beacons) {
+   uint8_t version, setting;
+   int count = 0;
+
+   while(beacons-- > 0) {
+      count += gossip_ShouldAdvertise(&version, &setting);
+   }
+   return count;
+}
@@ -0,0 +1,231 @@
+/*
+ * Turns a tokenized log (firmware built with LOG_TOKENIZED) back into text,
+ * using the format strings in the elf's .log_fmt section:
+ *
+ *    log_decode build/sympetrum-v2.elf < /dev/ttyUSB0
+ *    log_decode build/sympetrum-v2.elf capture.bin
+ *
+ * Needs the elf from the very build that's running. Anything that isn't a
+ * record (plain iprintf() output) passes straight through. Formats the way
+ * iprintf() does, so the text reads the same as an untokenized build's.
+ */
+#include "log.h"
+
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct decode_Elf {
+   uint8_t    *image;
+   size_t      size;
+   Elf32_Shdr *sections;
+   int         numSections;
+   // .log_fmt, where the tokens point
+   uint8_t    *formats;
+   uint32_t    formatsSize;
+};
+
+static bool decode_LoadElf(char const *path, struct decode_Elf *elf);
+static char const *decode_String(struct decode_Elf const *elf, uint32_t address);
+static void decode_Print(struct decode_Elf const *elf, char const *fmt, uint32_t const *args, int numArgs);
+static void decode_Number(uint32_t value, uint32_t base);
+
+int main(int argc, char **argv) {
+   struct decode_Elf elf;
+   uint8_t header[3];
+   uint32_t args[LOG_MAX_ARGS];
+   uint8_t word[4];
+   FILE *in = stdin;
+   int c, i;
+
+   if(argc < 2 || argc > 3 || !strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
+      fprintf(stderr, "usage: %s firmware.elf [capture]\n", argv[0]);
+      return 2;
+   }
+   if(!decode_LoadElf(argv[1], &elf)) {
+      return 1;
+   }
+   if(argc == 3 && !(in = fopen(argv[2], "rb"))) {
+      perror(argv[2]);
+      return 1;
+   }
+
+   // Unbuffered enough to follow a live port
+   setvbuf(stdout, NULL, _IOLBF, 0);
+
+   while((c = fgetc(in)) != EOF) {
+      uint16_t token;
+      uint8_t numArgs;
+
+      if(c != LOG_TOKEN_MARKER) {
+         putchar(c);
+         continue;
+      }
+
+      if(fread(header, 1, sizeof(header), in) != sizeof(header)) {
+         break;
+      }
+      token = header[0] | (header[1] << 8);
+      numArgs = header[2];
+
+      // Can't be ours. Nothing to resync on but the next marker
+      if(numArgs > LOG_MAX_ARGS || token >= elf.formatsSize) {
+         printf("<bad record 0x%04x/%d>", token, numArgs);
+         continue;
+      }
+
+      for(i = 0; i < numArgs && fread(word, 1, sizeof(word), in) == sizeof(word); i++) {
+         args[i] = word[0] | (word[1] << 8) | (word[2] << 16) | ((uint32_t)word[3] << 24);
+      }
+      if(i < numArgs) {
+         break;
+      }
+
+      decode_Print(&elf, (char const *)elf.formats + token, args, numArgs);
+   }
+
+   return 0;
+}
+
+/*
+ * Only what iprintf() knows: %s %d %c %x. Anything else after a % comes out
+ * as itself and takes no argument, same as on the badge.
+ */
+static void decode_Print(struct decode_Elf const *elf, char const *fmt, uint32_t const *args, int numArgs) {
+   int next = 0;
+
+   // The string runs to the end of the section at worst
+   for(; fmt < (char const *)elf->formats + elf->formatsSize && *fmt; fmt++) {
+      if(*fmt != '%') {
+         putchar(*fmt);
+         continue;
+      }
+      fmt++;
+
+      switch(*fmt) {
+         case 's':
+         case 'd':
+         case 'c':
+         case 'x':
+            if(next >= numArgs) {
+               printf("<missing>");
+               break;
+            }
+            if(*fmt == 's') {
+               fputs(decode_String(elf, args[next]), stdout);
+            } else if(*fmt == 'd') {
+               decode_Number(args[next], 10);
+            } else if(*fmt == 'c') {
+               putchar((uint8_t)args[next]);
+            } else {
+               decode_Number(args[next], 16);
+            }
+            next++;
+            break;
+         case '\0':
+            return;
+         default:
+            putchar(*fmt);
+            break;
+      }
+   }
+}
+
+/*
+ * iprintf()'s numbers: %d is really unsigned, %x comes in whole bytes.
+ */
+static void decode_Number(uint32_t value, uint32_t base) {
+   char digits[12];
+   int n = 0;
+
+   do {
+      digits[n++] = "0123456789abcdef"[value % base];
+      value /= base;
+   } while(value);
+   if(base == 16 && (n % 2) != 0) {
+      digits[n++] = '0';
+   }
+
+   while(n > 0) {
+      putchar(digits[--n]);
+   }
+}
+
+/*
+ * A %s argument is a pointer on the badge. Strings in flash can be read out of
+ * the elf, anything in RAM is gone.
+ */
+static char const *decode_String(struct decode_Elf const *elf, uint32_t address) {
+   static char unknown[32];
+
+   for(int i = 0; i < elf->numSections; i++) {
+      Elf32_Shdr const *s = &elf->sections[i];
+
+      if(s->sh_type == SHT_PROGBITS && (s->sh_flags & SHF_ALLOC) && !(s->sh_flags & SHF_WRITE) &&
+            address >= s->sh_addr && address < s->sh_addr + s->sh_size &&
+            memchr(elf->image + s->sh_offset + (address - s->sh_addr), '\0', s->sh_addr + s->sh_size - address)) {
+         return (char const *)elf->image + s->sh_offset + (address - s->sh_addr);
+      }
+   }
+
+   snprintf(unknown, sizeof(unknown), "<string at 0x%08x>", address);
+   return unknown;
+}
+
+static bool decode_LoadElf(char const *path, struct decode_Elf *elf) {
+   FILE *f = fopen(path, "rb");
+   Elf32_Ehdr *eh;
+   char const *names;
+
+   if(!f) {
+      perror(path);
+      return false;
+   }
+   fseek(f, 0, SEEK_END);
+   elf->size = ftell(f);
+   rewind(f);
+   elf->image = malloc(elf->size);
+   if(!elf->image || fread(elf->image, 1, elf->size, f) != elf->size) {
+      fprintf(stderr, "%s: can't read\n", path);
+      fclose(f);
+      return false;
+   }
+   fclose(f);
+
+   eh = (Elf32_Ehdr *)elf->image;
+   if(elf->size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) ||
+         eh->e_ident[EI_CLASS] != ELFCLASS32 || eh->e_ident[EI_DATA] != ELFDATA2LSB ||
+         eh->e_shoff + (size_t)eh->e_shnum * sizeof(Elf32_Shdr) > elf->size ||
+         eh->e_shstrndx >= eh->e_shnum) {
+      fprintf(stderr, "%s: not a 32 bit little endian elf\n", path);
+      return false;
+   }
+
+   elf->sections = (Elf32_Shdr *)(elf->image + eh->e_shoff);
+   elf->numSections = eh->e_shnum;
+   names = (char const *)elf->image + elf->sections[eh->e_shstrndx].sh_offset;
+
+   elf->formats = NULL;
+   elf->formatsSize = 0;
+   for(int i = 0; i < elf->numSections; i++) {
+      Elf32_Shdr const *s = &elf->sections[i];
+
+      if(s->sh_offset + (size_t)s->sh_size > elf->size && s->sh_type != SHT_NOBITS) {
+         fprintf(stderr, "%s: section %d runs off the end\n", path, i);
+         return false;
+      }
+      if(!strcmp(names + s->sh_name, ".log_fmt")) {
+         elf->formats = elf->image + s->sh_offset;
+         elf->formatsSize = s->sh_size;
+      }
+   }
+
+   if(!elf->formats) {
+      fprintf(stderr, "%s: no .log_fmt section, was it built with LOG_TOKENIZED=1?\n", path);
+      return false;
+   }
+   return true;
+}
@@ -0,0 +1,95 @@
+#!/bin/sh
+#
+# Turns a PROFILE dump (see Inc/profile.h) into samples per function, hottest
+# first, using the symbols in the elf from the same build:
+#
+#    Host/Tools/profile.sh build/sympetrum-v2.elf capture.txt
+#
+# The capture can have anything else in it too, only PROFILE/PROF lines are
+# read (from stdin if there's no file). Buckets straddling functions are split
+# between them by how many bytes of each they cover, so small neighbouring
+# functions blur a little. NM picks the nm to use.
+
+NM=${NM:-/usr/local/gcc-arm-none-eabi-6_2-2016q4/bin/arm-none-eabi-nm}
+
+if [ $# -lt 1 ] || [ $# -gt 2 ]; then
+   echo "usage: $0 firmware.elf [capture]" >&2
+   exit 2
+fi
+
+SYMS=$(mktemp) || exit 1
+trap 'rm -f "$SYMS"' EXIT
+"$NM" -S --defined-only "$1" > "$SYMS" || exit 1
+
+echo "   samples  share  function"
+awk -v syms="$SYMS" '
+function hex(s,    i, n, c) {
+   n = 0
+   s = tolower(s)
+   sub(/^0x/, "", s)
+   for(i = 1; i <= length(s); i++) {
+      c = index("0123456789abcdef", substr(s, i, 1))
+      if(c == 0) {
+         break
+      }
+      n = n * 16 + c - 1
+   }
+   return n
+}
+
+# nm: address size type name. Code only, Thumb bit off
+BEGIN {
+   while((getline line < syms) > 0) {
+      split(line, f, " ")
+      if(f[3] ~ /^[tTwW]$/ && hex(f[2]) > 0) {
+         funcs++
+         fstart[funcs] = hex(f[1]) - hex(f[1]) % 2
+         fend[funcs] = fstart[funcs] + hex(f[2])
+         fname[funcs] = f[4]
+      }
+   }
+}
+
+{
+   gsub(/\r/, "")
+}
+
+$1 == "PROFILE" && $2 ~ /^base=/ {
+   base = hex(substr($2, 6))
+   shift = substr($3, 7) + 0
+   samples += substr($4, 9) + 0
+   other += substr($5, 7) + 0
+}
+
+$1 == "PROF" && shift > 0 {
+   lo = base + $2 * 2 ^ shift
+   hi = lo + 2 ^ shift
+   left = $3
+   for(i = 1; i <= funcs; i++) {
+      a = (fstart[i] > lo) ? fstart[i] : lo
+      b = (fend[i] < hi) ? fend[i] : hi
+      if(b > a) {
+         share = $3 * (b - a) / (hi - lo)
+         hits[fname[i]] += share
+         left -= share
+      }
+   }
+   # padding, literal pools past a function, or no symbol at all
+   if(left > 0.001) {
+      hits["(no symbol)"] += left
+   }
+}
+
+END {
+   if(samples == 0) {
+      print "no PROFILE samples found" > "/dev/stderr"
+      exit 1
+   }
+   if(other > 0) {
+      hits["(outside flash)"] += other
+   }
+
+   for(name in hits) {
+      printf("%10.1f %6.2f%%  %s\n", hits[name], 100 * hits[name] / samples, name)
+   }
+}' "${2:--}" | sort -rn
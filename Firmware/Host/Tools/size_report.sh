@@ -0,0 +1,145 @@
+#!/bin/sh
+#
+# Flash and RAM per module, biggest first, from the map file of a build and
+# its elf:
+#
+#    Host/Tools/size_report.sh build/sympetrum-v2.elf build/sympetrum-v2.map
+#
+# Every input section the map places in flash (.isr_vector to .fini_array,
+# and .data's load image) or RAM (.data, .bss) is charged to the object it
+# came from. Library members count towards their library. LTO builds come out
+# of the link as ltrans objects with no module left in their names, so code
+# there is charged to the source file of the function at its address (from
+# the debug info, so build with -g). Statics LTO renamed can't be traced back
+# that way and are listed as (lto): build with LTO=0 for exact numbers. NM
+# picks the nm to use.
+
+NM=${NM:-/usr/local/gcc-arm-none-eabi-6_2-2016q4/bin/arm-none-eabi-nm}
+
+if [ $# -ne 2 ]; then
+   echo "usage: $0 firmware.elf firmware.map" >&2
+   exit 2
+fi
+
+SYMS=$(mktemp) || exit 1
+TOTAL=$(mktemp) || exit 1
+trap 'rm -f "$SYMS" "$TOTAL"' EXIT
+"$NM" -l --defined-only "$1" > "$SYMS" || exit 1
+
+echo "   flash     ram  module"
+awk -v syms="$SYMS" -v total="$TOTAL" '
+function hex(s,    i, n, c) {
+   n = 0
+   s = tolower(s)
+   sub(/^0x/, "", s)
+   for(i = 1; i <= length(s); i++) {
+      c = index("0123456789abcdef", substr(s, i, 1))
+      if(c == 0) {
+         break
+      }
+      n = n * 16 + c - 1
+   }
+   return n
+}
+
+# What a source or object path is called in the report
+function module(path) {
+   if(path ~ /\.a\(/) {
+      sub(/\(.*/, "", path)
+   }
+   sub(/.*\//, "", path)
+   sub(/\.(c|h|s|o|obj)$/, "", path)
+   return path
+}
+
+function charge(section, address, size, object,    m) {
+   if(size == 0 || !(section in kind)) {
+      return
+   }
+   if(object ~ /ltrans/) {
+      m = (address in owner) ? owner[address] : "(lto)"
+   }
+   else {
+      m = module(object)
+   }
+   if(kind[section] != "ram") {
+      flash[m] += size
+   }
+   if(kind[section] != "flash") {
+      ram[m] += size
+   }
+}
+
+# nm -l: address type name, then file:line after a tab when it has one
+BEGIN {
+   split(".isr_vector .text .rodata .ARM.extab .ARM .preinit_array .init_array .fini_array", f, " ")
+   for(i in f) {
+      kind[f[i]] = "flash"
+   }
+   kind[".data"] = "both"
+   kind[".bss"] = "ram"
+
+   while((getline line < syms) > 0) {
+      n = split(line, f, "\t")
+      if(n > 1) {
+         split(f[1], a, " ")
+         sub(/:[0-9]+$/, "", f[2])
+         owner[hex(a[1])] = module(f[2])
+      }
+   }
+}
+
+{
+   gsub(/\r/, "")
+}
+
+/^Linker script and memory map/ {
+   inMap = 1
+}
+!inMap {
+   next
+}
+
+# An output section: its name starts the line
+/^\.[^ ]/ {
+   section = $1
+   pending = ""
+   next
+}
+
+# An input section, all on one line, or its name alone with the rest on the
+# next line when the name is long
+/^ \.[^ ]/ || /^ COMMON/ {
+   if(NF >= 4 && $2 ~ /^0x/ && $3 ~ /^0x/) {
+      charge(section, hex($2), hex($3), $4)
+      pending = ""
+   }
+   else if(NF == 1) {
+      pending = $1
+   }
+   next
+}
+pending != "" && NF >= 3 && $1 ~ /^0x/ && $2 ~ /^0x/ {
+   charge(section, hex($1), hex($2), $3)
+   pending = ""
+   next
+}
+{
+   pending = ""
+}
+
+END {
+   for(m in flash) {
+      seen[m] = 1
+   }
+   for(m in ram) {
+      seen[m] = 1
+   }
+   for(m in seen) {
+      printf("%8d %7d  %s\n", flash[m], ram[m], m)
+      totalFlash += flash[m]
+      totalRam += ram[m]
+   }
+   printf("%8d %7d  %s\n", totalFlash, totalRam, "(total)") > total
+}' "$2" | sort -rn
+cat "$TOTAL"
@@ -4,13 +4,69 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "gossip.h"
+
+// Beacons are held back a random number of slots after the clock tick that
+// triggered them so that synchronized badges don't all transmit on top of each
+// other. A slot is a little longer than one frame of airtime.
+#define BEACON_TX_SLOTS          (8)
+#define BEACON_TX_SLOT_US        (32000)
+
+// Longest a badge goes between beacons, however many ticks it skips to save
+// power (see pattern_SetBeaconEvery()): the slowest beacon interval. Neighbor
+// timeouts and how long we stay awake to hear a newcomer are built on it.
+#define BEACON_MAX_GAP_MS        (30000)
+
+// The crowd epoch goes out in pieces, in the frames following a clock frame.
+// It's whole seconds (see pattern.c), 7 bits a piece, so 21 bits of it: good
+// for 24 days.
+#define BEACON_EPOCH_CHUNKS      (3)
+
+// Clock frames only have room for one bit of the epoch, ~65s's worth. Half the
+// time that tells a neighbor from another crowd apart. The rest look alike
+// until the full epoch comes along, within a few beacons (EPOCH_EVERY_N_BEACONS
+// in pattern.c). Till then they pull on each other's phase, which joining the
+// older crowd undoes anyway.
+#define BEACON_EPOCH_TAG_MASK    (0x1)
+#define BEACON_EPOCH_TAG(e)      ((uint8_t)(((e) >> 16) & BEACON_EPOCH_TAG_MASK))
+
+enum beacon_Type {
+   BT_Clock,
+   BT_Epoch,
+   BT_Gossip,
+};
+
+struct beacon_Beacon {
+   enum beacon_Type  type;
+   // BT_Clock: hash of the sender's ID, to tell neighbors apart
+   uint8_t           senderID;
+   // BT_Clock: tag of the sender's crowd epoch
+   uint8_t           epochTag;
+   // BT_Epoch: the sender's crowd epoch as of its clock tick, in ms
+   uint32_t          epoch;
+   // BT_Gossip: a crowd-wide setting and its version (see gossip.h)
+   uint8_t           version;
+   uint8_t           setting;
+   // when the sender's beacon clock ticked, in our platformHW_GetMicros() time
+   uint32_t          tickUS;
+};
+
 void beacon_Init(void);
+void beacon_GiveTime(void);
+uint32_t beacon_TimeToNextEvent(void);
 
 //TODO beacon API for rx beacon? to be called from IT?
-bool beacon_Receive(uint16_t *rawBeacon);
-void beacon_Send(uint16_t rawData);
+bool beacon_Receive(struct beacon_Beacon *beacon);
+bool beacon_Send(uint32_t epoch, uint8_t slot, bool withEpoch,
+      struct beacon_Beacon const * const gossip);
 
 uint32_t beacon_LastReceived(void);
+bool beacon_IsSending(void);
+bool beacon_IsReceiving(void);
+bool beacon_ChannelBusy(void);
+
+uint16_t beacon_AddCheck(uint16_t frame);
+bool beacon_CheckPasses(uint16_t raw);
 
 
 #endif//BEACONS_H__
@@ -4,6 +4,8 @@
 #include <stdint.h>
 
 uint32_t bid_GetID(void);
+uint32_t bid_GetHash(void);
+void bid_Report(void);
 
 #endif//BOARD_ID_H__
 
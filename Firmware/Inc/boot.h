@@ -0,0 +1,35 @@
+#ifndef BOOT_H__
+#define BOOT_H__
+
+#include <stdint.h>
+
+/*
+ * Boot profile. main() marks the end of each init stage, in us since
+ * HAL_Init() (the startup code before that is a few us of copying .data and
+ * clearing .bss). Only to the ms until platformHW_Init() has the clock set up.
+ *
+ * Sent once boot's done, and again whenever 'b' comes in on USART1:
+ *    BOOT hal=<us> platform=<us> ... ready=<us>
+ * frame is when the first LED frame went out, the one that counts for how
+ * quickly a badge lights up.
+ */
+enum boot_Stage {
+   BS_HAL,
+   // clocks, pins, UART, metrics
+   BS_Platform,
+   BS_LED,
+   BS_FirstFrame,
+   // the PRNG seeded, from ADC noise
+   BS_Seed,
+   // pattern, beacons and IR
+   BS_Pattern,
+   BS_Power,
+   BS_Ready,
+
+   BS_Count
+};
+
+void boot_Mark(enum boot_Stage stage);
+void boot_Report(void);
+
+#endif//BOOT_H__
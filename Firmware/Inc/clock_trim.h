@@ -0,0 +1,18 @@
+#ifndef CLOCK_TRIM_H__
+#define CLOCK_TRIM_H__
+
+/*
+ * Steers our HSI towards the average clock of the badges we hear, using how
+ * long their IR half bits look to us.
+ */
+
+#include <stdint.h>
+
+// How much one trim step speeds the clock up, in parts per million
+#define CT_STEP_PPM     (5000)
+
+void ct_Init(void);
+void ct_SawFrame(uint16_t halfBitQ4);
+int8_t ct_TakeSteps(void);
+
+#endif//CLOCK_TRIM_H__
@@ -0,0 +1,52 @@
+#ifndef EVENTS_H__
+#define EVENTS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * What the main loop sleeps on. Interrupts post events when something happens
+ * that the loop has to deal with, and modules that have work due at a known
+ * time set a deadline. events_Wait() sleeps (WFI) until there's either.
+ *
+ * Events are flags, so posting one that's still pending does nothing. Whoever
+ * handles it looks at everything that's come in since.
+ *
+ * Allowed to, it sleeps in stop mode instead when there's long enough to go.
+ * That loses whatever wakes it early (a beacon's first frame, a request's
+ * first character), so after one of those it keeps to WFI for a while.
+ */
+enum events_Event {
+   // the IR decoder has a frame
+   EV_IRFrame     = (1 << 0),
+   // the IR encoder finished a frame
+   EV_IRTxDone    = (1 << 1),
+   EV_Button      = (1 << 2),
+   // a character came in on USART1
+   EV_Request     = (1 << 3),
+};
+
+enum events_Deadline {
+   // pattern_TimeToNextEvent()
+   ED_Pattern,
+   // the next LED frame
+   ED_LEDFrame,
+
+   ED_Count
+};
+
+// no deadline
+#define EVENTS_NEVER             (UINT32_MAX)
+
+void events_Init(void);
+
+void events_Post(uint32_t events);
+uint32_t events_Take(void);
+
+void events_SetDeadline(enum events_Deadline id, uint32_t nowUS, uint32_t inUS);
+bool events_Due(enum events_Deadline id, uint32_t nowUS);
+
+void events_AllowStop(bool allow);
+uint32_t events_Wait(void);
+
+#endif//EVENTS_H__
@@ -0,0 +1,27 @@
+#ifndef GOSSIP_H__
+#define GOSSIP_H__
+
+/*
+ * Spreads one crowd-wide setting (and its version) from badge to badge. Newer
+ * versions win, and on the same version the higher setting. Badges stop
+ * repeating it once enough neighbors are. A badge that's never had a setting
+ * takes the first one it hears, whatever the version, and has nothing to say
+ * until then.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Versions wrap, and are compared like TCP sequence numbers
+#define GOSSIP_VERSION_MASK      (0x1F)
+#define GOSSIP_SETTING_MASK      (0x0F)
+
+void gossip_Init(void);
+
+void gossip_Originate(uint8_t setting);
+bool gossip_Heard(uint8_t version, uint8_t setting);
+bool gossip_ShouldAdvertise(uint8_t *version, uint8_t *setting);
+
+uint8_t gossip_Setting(void);
+
+#endif//GOSSIP_H__
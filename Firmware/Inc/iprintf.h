@@ -4,7 +4,28 @@
 #ifndef IPRINTF_H
 #define IPRINTF_H
 
-void iprintf(char *pszFmt,...);
+#include <stdint.h>
+#include <stdbool.h>
+
+// Only %d, %x, %s and %c, with no widths or flags. Arguments are checked
+// against the format like printf's, so cast uint32_t (a long here) to int.
+void iprintf(char *pszFmt,...) __attribute__((format(printf, 1, 2)));
+
+// Raw bytes, all sent or all dropped (len no more than the buffer)
+void iprintf_Write(uint8_t const *data, uint16_t len);
+// Blocks until the output's been sent
+void iprintf_Flush(void);
+// While on, printing from the main loop waits for room instead of dropping.
+// For reports asked for by hand, which hold up the main loop till they're out.
+void iprintf_Blocking(bool on);
+// Characters lost to a full buffer since boot
+uint32_t iprintf_GetDropped(void);
+
+// The last byte received over USART1, if there's been one since last time
+bool iprintf_GetChar(uint8_t *ch);
+
+//used internally, from USART1's ISR
+void iprintf_UartISR(void);
 
 #endif
 /* [] END OF FILE */
@@ -0,0 +1,35 @@
+#ifndef IR_CAPTURE_H__
+#define IR_CAPTURE_H__
+
+#include <stdint.h>
+
+/*
+ * Edge recorder for the IR receiver. Every edge TIM3 captures goes into a RAM
+ * ring as microseconds since the previous edge and the pin's level after it,
+ * the same thing ir_DataSampling() gets. Send 'c' to USART1 for what's in it,
+ * oldest first, which then starts over:
+ *    # IR capture <n> edges
+ *    <us> <level>
+ *    ...
+ *    # IR capture end
+ * That's the host IR bench's capture format, so build/host/ir_bench -f plays
+ * it back into the decoder exactly as the badge saw it.
+ *
+ * Only built with IR_CAPTURE_ENABLED (make IR_CAPTURE=1), as the ring takes
+ * a good chunk of RAM.
+ */
+#ifdef IR_CAPTURE_ENABLED
+
+void ir_CaptureEdge(uint16_t ticks, uint8_t level);
+void ir_CaptureTimeout(void);
+void ir_CaptureReport(void);
+
+#else
+
+#define ir_CaptureEdge(ticks, level)   do { } while(0)
+#define ir_CaptureTimeout()            do { } while(0)
+#define ir_CaptureReport()             do { } while(0)
+
+#endif
+
+#endif//IR_CAPTURE_H__
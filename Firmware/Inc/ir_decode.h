@@ -10,6 +10,8 @@ typedef struct
    __IO uint8_t ToggleBit;  /*!< Toggle bit field */
    __IO uint8_t Address;    /*!< Address field */
    __IO uint8_t Command;    /*!< Command field */
+   __IO uint32_t ArrivalUS; /*!< Time of the frame's first edge (platformHW_GetMicros) */
+   __IO uint16_t HalfBitQ4; /*!< Sender's half bit as we measured it, us * 16. 0 if unknown */
 } RC5_Frame_TypeDef;
 
 void ir_InitDecode(void);
@@ -17,10 +19,14 @@ bool ir_GetDecoded(uint16_t *raw, RC5_Frame_TypeDef *rc5_frame);
 
 //used internally to decode incoming IR data
 void ir_ResetPacket(void);
+void ir_PacketTimeout(void);
 void ir_DataSampling(uint16_t rawPulseLength, uint8_t edge);
 
 void ir_DecodeDisable(void);
 void ir_DecodeEnable(void);
+bool ir_IsReceiving(void);
+void ir_DecodeClockChanged(void);
+void ir_DecodeReport(void);
 
 #endif /* __IR_DECODE_H */
 
@@ -10,11 +10,17 @@ typedef enum
    RC5_Ctrl_Set                          = ((uint16_t)0x0800)
 } RC5_Ctrl_TypeDef;
 
+/* TIM16 period, in 48MHz counts, of one Manchester half bit (~888us). Scaled
+   to whatever PCLK really is. */
+#define IR_HALF_BIT_PERIOD                    (42627)
+#define IR_HALF_BIT_PERIOD_KHZ                (48000)
+
 void ir_InitEncode(void);
 void ir_SendRC5(uint8_t RC5_Address, uint8_t RC5_Instruction, RC5_Ctrl_TypeDef RC5_Ctrl);
 void ir_SendRaw(uint16_t message);
 void ir_SignalGenerate(void);
 bool ir_IsSending(void);
+void ir_EncodeClockChanged(void);
 
 #endif  /*__IR_ENCODE_H */
 
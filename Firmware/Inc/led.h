@@ -17,12 +17,16 @@ bool led_StartAnimation(void);
 
 // YABI is used internally for all LED control
 bool led_SetChannel(uint32_t id, struct color_ColorHSV c);
+bool led_ShowNow(struct color_ColorHSV const * const colors);
 
 void led_SetBiasValue(uint8_t biasValue);
 void led_SetBiasWeight(uint8_t biasWeight);
 void led_SetAnimationSpeeds(uint32_t frameTime, uint32_t transitionTime);
 
 void led_GiveTime(uint32_t systimeMS);
+uint32_t led_TimeToNextFrame(uint32_t systimeMS);
+void led_SetSlowFrames(bool slow);
+void led_SetFrameStretch(uint8_t stretch);
 
 #endif//LED_H__
 
@@ -0,0 +1,81 @@
+/*
+ * Leveled logging. LOG_LEVEL (from the Makefile) decides what's compiled in at
+ * all: anything below it is gone. Its arguments are still checked but never
+ * evaluated, so don't put side effects in them.
+ *
+ * By default it's text through iprintf(). Built with LOG_TOKENIZED the format
+ * strings go in .log_fmt, which is kept in the elf but never loaded, so they
+ * cost no flash. A log is then sent as its string's offset in there plus the
+ * raw argument words, and log_decode puts the text back together from the elf
+ * (see log_Tokenized() for the record).
+ */
+#ifndef LOG_H
+#define LOG_H
+
+#include "iprintf.h"
+
+#include <stdint.h>
+
+#define LOG_LEVEL_DEBUG    (0)
+#define LOG_LEVEL_INFO     (1)
+#define LOG_LEVEL_WARN     (2)
+#define LOG_LEVEL_ERROR    (3)
+#define LOG_LEVEL_NONE     (4)
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL          LOG_LEVEL_DEBUG
+#endif
+
+// Record marker. Never the first byte of text, iprintf() only sends ASCII
+#define LOG_TOKEN_MARKER   (0xFF)
+#define LOG_MAX_ARGS       (8)
+
+#ifdef LOG_TOKENIZED
+
+// How many arguments, up to LOG_MAX_ARGS, where ##__VA_ARGS__ has eaten the
+// comma if there aren't any
+#define LOG_COUNT_ARGS(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...)  n
+
+#define LOG_EMIT(fmt, ...) do { \
+      static char const LogFormat[] __attribute__((section(".log_fmt"), used)) = fmt; \
+      log_Tokenized((uint16_t)(uintptr_t)LogFormat, \
+            LOG_COUNT_ARGS(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0), ##__VA_ARGS__); \
+   } while(0)
+
+void log_Tokenized(uint16_t token, uint8_t numArgs, ...);
+
+#else
+
+#define LOG_EMIT(fmt, ...) iprintf(fmt, ##__VA_ARGS__)
+
+#endif
+
+// Compiles, so variables only logged aren't unused and the arguments are still
+// checked against the format (see iprintf.h), but never runs
+#define LOG_NOTHING(...)   do { if(0) { iprintf(__VA_ARGS__); } } while(0)
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...)     LOG_EMIT(__VA_ARGS__)
+#else
+#define LOG_DEBUG(...)     LOG_NOTHING(__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...)      LOG_EMIT(__VA_ARGS__)
+#else
+#define LOG_INFO(...)      LOG_NOTHING(__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...)      LOG_EMIT(__VA_ARGS__)
+#else
+#define LOG_WARN(...)      LOG_NOTHING(__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...)     LOG_EMIT(__VA_ARGS__)
+#else
+#define LOG_ERROR(...)     LOG_NOTHING(__VA_ARGS__)
+#endif
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef METRICS_H__
+#define METRICS_H__
+
+#include <stdint.h>
+
+/*
+ * Counters and gauges for seeing what a badge in the field is up to. Each is a
+ * plain increment or store, cheap enough to leave in every build. Counters wrap,
+ * and one bumped from both an ISR and the main loop can miss a count now and
+ * then, which is fine for a rough picture.
+ *
+ * Send 'm' to USART1 for one line of all of them:
+ *    METRICS up=<ms> btx=<n> ... logdrop=<n>
+ * followed by timing.h's sections, in TIMING builds.
+ */
+enum metrics_ID {
+   MID_UptimeMS,
+   // beacon bursts sent, usable beacons received
+   MID_BeaconsTx,
+   MID_BeaconsRx,
+   // every frame the IR decoder finished, and the ones beacons had no use for
+   // (failed the check bits, or out of place)
+   MID_FramesRx,
+   MID_FramesRejected,
+   // why the decoder threw a frame away: pulse not 1 or 2 half bits, bits that
+   // don't make Manchester sense, went quiet part way through
+   MID_DecodeBadPulse,
+   MID_DecodeBadBit,
+   MID_DecodeTimeout,
+   // LED frames pumped, and ones that should have been but the loop was late
+   MID_LEDFrames,
+   MID_LEDFramesSkipped,
+   // frames dimmed to fit the LED current budget, what the LEDs are estimated
+   // to draw now (mA) and have used since boot (mAh)
+   MID_LEDFramesLimited,
+   MID_LEDmA,
+   MID_LEDmAh,
+   MID_LoopMaxUS,
+   // time spent in WFI or stop mode waiting for events, so the duty cycle is
+   // 1 - sleep / up
+   MID_SleepMS,
+   // times in stop mode, and the longest it took to get the PLL back after
+   MID_Stops,
+   MID_WakeMaxUS,
+   // switches between 48MHz and 8MHz, either way
+   MID_ClockSwitches,
+   // power.h: VDD, level, what we're estimated to be drawing from the cell and
+   // how long that leaves
+   MID_VddMV,
+   MID_PowerLevel,
+   MID_BatteryUA,
+   MID_RuntimeMin,
+   MID_ISRSysTick,
+   MID_ISRButton,
+   MID_ISRIRRx,
+   MID_ISRIRTx,
+   MID_ISRUart,
+   MID_RampPosition,
+   // stack never touched since boot, and RAM taken by .data and .bss
+   MID_StackFree,
+   MID_StaticRAM,
+   MID_LogDropped,
+
+   MID_Count
+};
+
+void metrics_Init(void);
+void metrics_GiveTime(uint32_t loopUS);
+void metrics_Report(void);
+
+void metrics_Count(enum metrics_ID id);
+void metrics_CountN(enum metrics_ID id, uint32_t n);
+void metrics_Set(enum metrics_ID id, uint32_t value);
+uint32_t metrics_Get(enum metrics_ID id);
+
+#endif//METRICS_H__
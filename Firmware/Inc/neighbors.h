@@ -0,0 +1,18 @@
+#ifndef NEIGHBORS_H__
+#define NEIGHBORS_H__
+
+/*
+ * Tracks which distinct badges we've heard from lately, so a chatty neighbor
+ * (or one heard twice) counts once.
+ */
+
+#include <stdint.h>
+
+// Fixed size. When it's full the least recently heard badge gets dropped.
+#define NEIGHBOR_TABLE_LEN       (8)
+
+void nbr_Init(void);
+void nbr_Saw(uint8_t id);
+uint8_t nbr_Count(void);
+
+#endif//NEIGHBORS_H__
@@ -3,11 +3,40 @@
 
 #include <stdint.h>
 
+#include "beacons.h"
+
+// Crowd epochs closer than this are the same crowd, give or take phase error.
+// They count whole seconds, and within a crowd they're exactly the same.
+#define PATTERN_EPOCH_MATCH_MS   (500)
+// Every beacon interval is a multiple of this, and phase is kept to it, so
+// neighbors on different intervals still tick together
+#define PATTERN_INTERVAL_GRID_MS (5000)
+
+// A snapshot of the clocks, for diagnostics
+struct pattern_Status {
+   // local platformHW_GetMicros() time of the last beacon clock tick
+   uint32_t    beaconTickUS;
+   uint16_t    beaconIntervalMS;
+   // how much later than our own clock says we tick, per second of it
+   int16_t     phaseRateUS;
+   // crowd epoch as of that tick
+   uint32_t    epochMS;
+   uint8_t     neighbors;
+   uint8_t     mode;
+   // a beacon burst is going out, or one's coming in
+   bool        sending;
+   bool        receiving;
+};
+
 //FIXME move config out into struct?
 void pattern_Init(void);
-void pattern_GiveTime(uint32_t const systimeMS);
+void pattern_GiveTime(uint32_t const systimeUS);
+uint32_t pattern_TimeToNextEvent(uint32_t const systimeUS);
+void pattern_GetStatus(struct pattern_Status * const status);
+void pattern_SetBeaconEvery(uint8_t every);
 
-void pattern_SawBeacon(uint16_t rawBeacon);
+void pattern_SawBeacon(struct beacon_Beacon const * const beacon);
+void pattern_ButtonPressed(void);
 
 #endif//PATTERN_H__
 
@@ -36,7 +36,42 @@ union platformHW_LEDRegister {
 bool platformHW_Init(void);
 bool platformHW_SpiInit(SPI_HandleTypeDef * const spi, SPI_TypeDef* spiInstance);
 
-void platformHW_UpdateLEDs(SPI_HandleTypeDef* spi);
+void platformHW_UpdateLEDs(SPI_HandleTypeDef* spi, struct color_ColorHSV const * const leds);
+void platformHW_SetLEDBrightness(uint8_t percent);
+void platformHW_SetLEDBudget(uint32_t ua);
+uint32_t platformHW_GetLEDCurrentUA(void);
+
+void platformHW_TimStartIT(TIM_HandleTypeDef * const tim);
+void platformHW_TimStopIT(TIM_HandleTypeDef * const tim);
+void platformHW_TimPWMStart(TIM_HandleTypeDef * const tim);
+void platformHW_TimPWMStop(TIM_HandleTypeDef * const tim);
+uint32_t platformHW_TimCapture(TIM_HandleTypeDef * const tim);
+
+uint32_t platformHW_GetMicros(void);
+uint8_t platformHW_TrimHSI(int8_t steps);
+uint32_t platformHW_StackFree(void);
+uint32_t platformHW_StaticRAM(void);
+uint32_t platformHW_Noise(void);
+
+// 48MHz off the PLL, or 8MHz off the HSI
+bool platformHW_SetClock(bool fast);
+bool platformHW_IsClockFast(void);
+
+// What ended a platformHW_Stop()
+#define PLATFORMHW_WAKE_IR       (1 << 0)
+#define PLATFORMHW_WAKE_UART     (1 << 1)
+#define PLATFORMHW_WAKE_BUTTON   (1 << 2)
+#define PLATFORMHW_WAKE_ALARM    (1 << 3)
+#define PLATFORMHW_WAKE_OTHER    (1 << 4)
+
+#ifdef STOP_MODE_ENABLED
+uint32_t platformHW_Stop(uint32_t maxUS);
+void platformHW_CalibrateStop(void);
+#else
+// never stops, so the caller falls back on WFI
+#define platformHW_Stop(maxUS)            (0)
+#define platformHW_CalibrateStop()        do { } while(0)
+#endif
 
 
 #endif//PLATFORM_HW_H__
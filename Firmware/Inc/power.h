@@ -0,0 +1,31 @@
+#ifndef POWER_H__
+#define POWER_H__
+
+#include <stdint.h>
+
+/*
+ * Battery governor. Every so often VDD is measured against VREFINT, and how
+ * it looks, along with how long since we last heard anyone, picks a level.
+ * Each level trades looks for battery: dimmer LEDs, fewer frames, fewer
+ * beacons.
+ *
+ * The cell (one AAA) feeds a 3.3V boost, so VDD holds steady until the cell's
+ * nearly flat and the boost can't keep up. Until then the runtime left is an
+ * estimate from a rough model of what we draw. See the power metrics.
+ */
+enum power_Level {
+   PL_Normal,
+   // nobody heard in a long while, so nobody much to see us
+   PL_Alone,
+   // VDD sagging, the boost is running out of cell
+   PL_Low,
+   PL_Critical,
+
+   PL_Count
+};
+
+void power_Init(void);
+void power_GiveTime(uint32_t systimeUS);
+enum power_Level power_GetLevel(void);
+
+#endif//POWER_H__
@@ -0,0 +1,33 @@
+#ifndef PROFILE_H__
+#define PROFILE_H__
+
+#include <stdint.h>
+
+/*
+ * Statistical profiler. Every SysTick (1kHz) the PC it interrupted goes into a
+ * histogram of flash, so whatever's hot shows up: ours, HAL's, libc's, ISRs
+ * at lower priority than SysTick. Anything at SysTick's priority or above (or
+ * running with interrupts off) never gets sampled, and code that runs in lock
+ * step with the ms tick can alias.
+ *
+ * Send 'p' to USART1 for the histogram since the last time:
+ *    PROFILE base=<hex> shift=<bucket size, log2> samples=<n> other=<n>
+ *    PROF <bucket> <samples>
+ *    ...
+ *    PROFILE end
+ * and Host/Tools/profile.sh turns that into samples per function.
+ *
+ * Only built with PROFILE_ENABLED (make PROFILE=1).
+ */
+#ifdef PROFILE_ENABLED
+
+void profile_Sample(uint32_t pc);
+void profile_Report(void);
+
+#else
+
+#define profile_Report()         do { } while(0)
+
+#endif
+
+#endif//PROFILE_H__
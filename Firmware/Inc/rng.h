@@ -0,0 +1,19 @@
+#ifndef RNG_H__
+#define RNG_H__
+
+#include <stdint.h>
+
+/*
+ * The badge's random numbers, for the animation and the beacon slots.
+ * xorshift32: shifts and xors, four bytes of state, nothing from newlib. Ranges
+ * come from a multiply and a shift, not a divide. Good enough to look random,
+ * not to be unpredictable.
+ *
+ * Seed it from something that differs badge to badge and boot to boot (see
+ * main.c): badges off one tray share most of their unique ID.
+ */
+void rng_Seed(uint32_t seed);
+uint32_t rng_Next(void);
+uint32_t rng_Below(uint32_t range);
+
+#endif//RNG_H__
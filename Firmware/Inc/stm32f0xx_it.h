@@ -6,6 +6,7 @@
 #endif 
 
 void SysTick_Handler(void);
+void USART1_IRQHandler(void);
 
 #ifdef __cplusplus
 }
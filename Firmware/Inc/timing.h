@@ -0,0 +1,56 @@
+#ifndef TIMING_H__
+#define TIMING_H__
+
+#include <stdint.h>
+
+/*
+ * Cycle timing for hot sections, off TIM14 running at the core clock (the M0
+ * has no cycle counter of its own). Put TIMING_SCOPE(TS_Something) at the top
+ * of a block and everything from there to wherever the block is left (returns
+ * included) is timed. Count, min, mean and max per section are printed after
+ * the metrics line.
+ *
+ * Only built with TIMING_ENABLED (make TIMING=1). Otherwise it's all nothing,
+ * and TIM14 is left off.
+ */
+enum timing_Section {
+   TS_PatternGiveTime,
+   TS_LEDGiveTime,
+   TS_UpdateLEDs,
+   TS_IRRxISR,
+   TS_IRTxISR,
+
+   TS_Count
+};
+
+#ifdef TIMING_ENABLED
+
+struct timing_Scope {
+   enum timing_Section  section;
+   uint32_t             start;
+};
+
+#define TIMING_CONCAT_(a, b)     a##b
+#define TIMING_CONCAT(a, b)      TIMING_CONCAT_(a, b)
+
+#define TIMING_SCOPE(id) \
+   struct timing_Scope const TIMING_CONCAT(timingScope, __LINE__) \
+      __attribute__((cleanup(timing_End))) = {.section = (id), .start = timing_Now()}
+
+void timing_Init(void);
+void timing_Report(void);
+
+//used internally
+uint32_t timing_Now(void);
+void timing_End(struct timing_Scope const *scope);
+void timing_Overflow(void);
+
+#else
+
+#define TIMING_SCOPE(id)
+#define timing_Init()            do { } while(0)
+#define timing_Report()          do { } while(0)
+
+#endif
+
+#endif//TIMING_H__
@@ -1,65 +1,400 @@
 #include "beacons.h"
-#include "iprintf.h"
+#include "log.h"
 
 #include "ir_encode.h"
 #include "ir_decode.h"
+#include "platform_hw.h"
+#include "clock_trim.h"
+#include "board_id.h"
+#include "metrics.h"
+#include "rng.h"
 
 #include <stdint.h>
 #include <string.h>
 
+// Frame layout (13 bits survive, the start bit is eaten by the decoder syncing)
+// clock:  [12] 0, [11:9] TX slot, [8] epoch tag, [7:2] sender ID
+// epoch:  [12:11] 10, [10:9] chunk number (MSB first), [8:2] epoch seconds
+// gossip: [12:11] 11, [10:6] setting version, [5:2] setting
+// and [1:0] check bits over the rest in every frame. Two senders at once can
+// decode as a frame neither sent, and the check turns most of those away.
+#define BEACON_FRAME_BITS        (13)
+#define BEACON_TYPE_SHIFT        (11)
+#define BEACON_TYPE_MASK         (0x3)
+#define BEACON_SLOT_SHIFT        (9)
+#define BEACON_SLOT_MASK         (0x7)
+#define BEACON_TAG_SHIFT         (8)
+#define BEACON_ID_SHIFT          (2)
+#define BEACON_ID_MASK           (0x3F)
+#define BEACON_CHUNK_SHIFT       (9)
+#define BEACON_CHUNK_MASK        (0x3)
+#define BEACON_EPOCH_BITS_SHIFT  (2)
+#define BEACON_EPOCH_BITS        (7)
+#define BEACON_VERSION_SHIFT     (6)
+#define BEACON_SETTING_SHIFT     (2)
+
+// Types, as the top two bits. A clock frame only needs the top one.
+#define BEACON_FRAME_CLOCK       (0)
+#define BEACON_FRAME_EPOCH       (2)
+#define BEACON_FRAME_GOSSIP      (3)
+
+// A 2 bit CRC (x^2 + x + 1). Starting it from all ones means a frame of all
+// zeros doesn't pass.
+#define BEACON_CHECK_BITS        (2)
+#define BEACON_CHECK_MASK        (0x3)
+#define BEACON_CHECK_POLY        (0x3)
+#define BEACON_CHECK_INIT        (0x3)
+
+// The epoch goes out in seconds
+#define BEACON_EPOCH_STEP_MS     (1000)
+
+// Time from starting a transmission to the receiver's first edge. TIM16 fires
+// its first update one half bit in and the start bit opens with a space, so the
+// carrier comes up two half bits in. Then the demodulator takes a moment to react.
+#define IR_HALF_BIT_US           (888)
+#define IR_RX_DEMOD_DELAY_US     (200)
+#define BEACON_TX_LEAD_US        ((2 * IR_HALF_BIT_US) + IR_RX_DEMOD_DELAY_US)
+
+// Airtime of one frame: the start bit and 13 more, two half bits each
+#define BEACON_FRAME_US          (2 * 14 * IR_HALF_BIT_US)
+
+// Quiet time between the frames of a burst, past the decoder's 3.6ms timeout:
+// a frame heard only in part (the one that woke a badge from stop) is dropped
+// before the next starts, so it costs that frame alone
+#define BEACON_TX_GAP_MS         (10)
+#define BEACON_TX_QUEUE_LEN      (1 + 2 + BEACON_EPOCH_CHUNKS)
+
+// From the start of one frame of a burst to the next. The gap's counted in
+// SysTicks from whenever the main loop noticed the frame was out, so give or
+// take a couple of ms a frame.
+#define BEACON_FRAME_SPACING_US  (BEACON_FRAME_US + (BEACON_TX_GAP_MS * 1000))
+#define BEACON_SPACING_SLACK_US  (3000)
+
+// Once a frame's in, the rest of its burst can follow for this long
+#define BEACON_RX_BURST_MS       (((BEACON_TX_QUEUE_LEN - 1) * BEACON_FRAME_SPACING_US) / 1000)
+
+// Epoch chunks arriving longer than this after their clock frame (the
+// longest slot plus the rest of the burst) belong to someone else
+#define BEACON_EPOCH_WINDOW_US   ((BEACON_TX_SLOTS + BEACON_TX_QUEUE_LEN) * BEACON_TX_SLOT_US)
+
+enum beacon_TXPhase {
+   TXP_Idle,
+   TXP_Frame,
+   TXP_Gap,
+};
+
 struct beacon_State {
    // systime timestamp from the last time we got a packet
-   uint32_t    lastReceived;
+   uint32_t             lastReceived;
+
+   // what we go by on the air
+   uint8_t              id;
+
+   // the burst we're sending. The decoder stays off until it's all out
+   uint16_t             txQueue[BEACON_TX_QUEUE_LEN];
+   uint8_t              txNext;
+   uint8_t              txCount;
+   enum beacon_TXPhase  txPhase;
+   uint32_t             txGapStart;
+
+   // gossip frames only count as the two after a clock frame, and the same
+   uint32_t             rxClockUS;
+   uint8_t              rxGossipAt;
+   uint16_t             rxGossip;
+
+   // epoch being put back together from the frames after a clock frame
+   uint32_t             rxEpoch;
+   uint32_t             rxEpochTickUS;
+   uint8_t              rxEpochNext;
 };
 
 static struct beacon_State state;
 
+static uint8_t beacon_Check(uint16_t frame);
+
 void beacon_Init(void) {
    memset(&state, 0, sizeof(state));
+   state.txPhase = TXP_Idle;
+   state.rxEpochNext = BEACON_EPOCH_CHUNKS;
+   state.id = bid_GetHash() & BEACON_ID_MASK;
 
-   iprintf("Setting up RC5 encode/decode...");
+   LOG_INFO("Setting up RC5 encode/decode (ID %d)...", state.id);
    ir_InitEncode();
    ir_InitDecode();
-   iprintf("ok\r\n");
+   ct_Init();
+   LOG_INFO("ok\r\n");
 }
 
-// sends 14 bites of data
-void beacon_Send(uint16_t rawData) {
+/*
+ * Start a beacon burst: a clock frame tagged with the TX slot it went out in,
+ * optionally followed by gossip (if gossip isn't NULL) and the whole epoch.
+ * Only the first frame goes out now, beacon_GiveTime() sends the rest.
+ */
+bool beacon_Send(uint32_t epoch, uint8_t slot, bool withEpoch,
+      struct beacon_Beacon const * const gossip) {
+   int i;
+
+   if(state.txPhase != TXP_Idle) {
+      LOG_WARN("Still sending last beacon\r\n");
+      return false;
+   }
+
+   state.txCount = 0;
+   state.txQueue[state.txCount++] = beacon_AddCheck((BEACON_FRAME_CLOCK << BEACON_TYPE_SHIFT) |
+      ((slot & BEACON_SLOT_MASK) << BEACON_SLOT_SHIFT) |
+      (BEACON_EPOCH_TAG(epoch) << BEACON_TAG_SHIFT) | (state.id << BEACON_ID_SHIFT));
+
+   // Twice, see beacon_Receive()
+   if(gossip != NULL) {
+      state.txQueue[state.txCount] = beacon_AddCheck((BEACON_FRAME_GOSSIP << BEACON_TYPE_SHIFT) |
+         ((gossip->version & GOSSIP_VERSION_MASK) << BEACON_VERSION_SHIFT) |
+         ((gossip->setting & GOSSIP_SETTING_MASK) << BEACON_SETTING_SHIFT));
+      state.txQueue[state.txCount + 1] = state.txQueue[state.txCount];
+      state.txCount += 2;
+   }
+
+   if(withEpoch) {
+      epoch /= BEACON_EPOCH_STEP_MS;
+      for(i = 0; i < BEACON_EPOCH_CHUNKS; i++) {
+         state.txQueue[state.txCount++] = beacon_AddCheck((BEACON_FRAME_EPOCH << BEACON_TYPE_SHIFT) |
+            (i << BEACON_CHUNK_SHIFT) |
+            (((epoch >> (BEACON_EPOCH_BITS * (BEACON_EPOCH_CHUNKS - 1 - i))) &
+              ((1 << BEACON_EPOCH_BITS) - 1)) << BEACON_EPOCH_BITS_SHIFT));
+      }
+   }
+
    ir_DecodeDisable();
 
    //TODO what do we send?
    //ir_SendRC5(4, 23, RC5_Ctrl_Reset);
-   ir_SendRaw(rawData);
+   ir_SendRaw(state.txQueue[0]);
+   state.txNext = 1;
+   state.txPhase = TXP_Frame;
 
-   //FIXME remove to unblock?
-   while(ir_IsSending()) {}
+   metrics_Count(MID_BeaconsTx);
+   return true;
+}
+
+/*
+ * Push out the rest of a burst, one frame at a time.
+ */
+void beacon_GiveTime(void) {
+   switch(state.txPhase) {
+      case TXP_Frame:
+         if(!ir_IsSending()) {
+            state.txGapStart = HAL_GetTick();
+            state.txPhase = TXP_Gap;
+         }
+         break;
 
-   // Crappy hack to wait for sending to complete
-   HAL_Delay(10);
+      case TXP_Gap:
+         if(HAL_GetTick() - state.txGapStart < BEACON_TX_GAP_MS) {
+            break;
+         }
 
-   ir_DecodeEnable();
+         if(state.txNext < state.txCount) {
+            ir_SendRaw(state.txQueue[state.txNext++]);
+            state.txPhase = TXP_Frame;
+         }
+         else {
+            ir_DecodeEnable();
+            state.txPhase = TXP_Idle;
+         }
+         break;
+
+      case TXP_Idle:
+      default:
+         break;
+   }
+}
+
+/*
+ * How long until beacon_GiveTime() has something to do, in us. Sending a frame
+ * is left to the encoder's interrupts, which will wake whoever's waiting. A
+ * frame that's already finished is due now, or we'd sleep through the rest of
+ * the burst deaf.
+ */
+uint32_t beacon_TimeToNextEvent(void) {
+   uint32_t elapsedMS;
+
+   if(state.txPhase == TXP_Frame) {
+      return ir_IsSending() ? UINT32_MAX : 0;
+   }
+   if(state.txPhase != TXP_Gap) {
+      return UINT32_MAX;
+   }
+
+   elapsedMS = HAL_GetTick() - state.txGapStart;
+   return (elapsedMS < BEACON_TX_GAP_MS) ? (BEACON_TX_GAP_MS - elapsedMS) * 1000 : 0;
 }
 
 //TODO what do we connect this to? IT?
-bool beacon_Receive(uint16_t *rawBeacon) {
+bool beacon_Receive(struct beacon_Beacon *beacon) {
    RC5_Frame_TypeDef rcf;
+   uint16_t raw;
+   uint32_t elapsedUS;
+   uint8_t type;
+   uint8_t slot;
+   uint8_t chunk;
+
+   if(!ir_GetDecoded(&raw, &rcf)) {
+      return false;
+   }
+
+   LOG_DEBUG("Raw  0x%x\r\n", raw);
+   LOG_DEBUG("\r\n");
+
+   if(!beacon_CheckPasses(raw)) {
+      metrics_Count(MID_FramesRejected);
+      return false;
+   }
+
+   // Every frame is a sample of the sender's clock
+   ct_SawFrame(rcf.HalfBitQ4);
+
+   state.lastReceived = HAL_GetTick();
+
+   // Clock frames only have the top bit of the type
+   type = (raw >> BEACON_TYPE_SHIFT) & BEACON_TYPE_MASK;
+   if(type < BEACON_FRAME_EPOCH) {
+      type = BEACON_FRAME_CLOCK;
+   }
+
+   switch(type) {
+      case BEACON_FRAME_CLOCK:
+         slot = (raw >> BEACON_SLOT_SHIFT) & BEACON_SLOT_MASK;
+
+         beacon->type = BT_Clock;
+         beacon->senderID = (raw >> BEACON_ID_SHIFT) & BEACON_ID_MASK;
+         beacon->epochTag = (raw >> BEACON_TAG_SHIFT) & BEACON_EPOCH_TAG_MASK;
+         // Walk back from the first edge to when the sender's clock actually ticked
+         beacon->tickUS = rcf.ArrivalUS - BEACON_TX_LEAD_US - (slot * BEACON_TX_SLOT_US);
+
+         // Can't be our own reflection, the decoder is off while we send. So
+         // one with our ID is a neighbor that happened to hash the same (1 in
+         // 64), and still one to sync to. Move over so we count as two.
+         if(beacon->senderID == state.id) {
+            state.id = (state.id + 1 + rng_Below(BEACON_ID_MASK)) & BEACON_ID_MASK;
+            LOG_INFO("ID taken, now %d\r\n", state.id);
+         }
+
+         // the sender's gossip and epoch might follow
+         state.rxClockUS = rcf.ArrivalUS;
+         state.rxGossipAt = 1;
+         state.rxEpoch = 0;
+         state.rxEpochTickUS = beacon->tickUS;
+         state.rxEpochNext = 0;
+         metrics_Count(MID_BeaconsRx);
+         return true;
+
+      case BEACON_FRAME_EPOCH:
+         state.rxGossipAt = 0;
+         chunk = (raw >> BEACON_CHUNK_SHIFT) & BEACON_CHUNK_MASK;
 
-   if(ir_GetDecoded(rawBeacon, &rcf)) {
-      //FIXME rm
-      iprintf("Raw  0x%x\r\n", *rawBeacon);
-      iprintf("Addr   %d\r\n", rcf.Address);
-      iprintf("Comd   %d\r\n", rcf.Command);
-      iprintf("Field  %d\r\n", rcf.FieldBit);
-      iprintf("Toggle %d\r\n", rcf.ToggleBit);
-      iprintf("\r\n");
+         // Missed a piece, or this isn't the burst we think it is
+         if(chunk != state.rxEpochNext ||
+               rcf.ArrivalUS - state.rxEpochTickUS > BEACON_EPOCH_WINDOW_US) {
+            state.rxEpochNext = BEACON_EPOCH_CHUNKS;
+            metrics_Count(MID_FramesRejected);
+            return false;
+         }
 
-      state.lastReceived = HAL_GetTick();
+         state.rxEpoch = (state.rxEpoch << BEACON_EPOCH_BITS) |
+            ((raw >> BEACON_EPOCH_BITS_SHIFT) & ((1 << BEACON_EPOCH_BITS) - 1));
+         if(++state.rxEpochNext < BEACON_EPOCH_CHUNKS) {
+            return false;
+         }
 
-      return true;
+         beacon->type = BT_Epoch;
+         beacon->epoch = state.rxEpoch * BEACON_EPOCH_STEP_MS;
+         beacon->tickUS = state.rxEpochTickUS;
+         metrics_Count(MID_BeaconsRx);
+         return true;
+
+      case BEACON_FRAME_GOSSIP:
+      default:
+         // Changes everyone's mode, so be sure of it. Two frames colliding can
+         // read as anything, check bits and all, and everyone who heard both
+         // reads the same thing. So it goes out twice, right after the clock
+         // frame, and only counts if both copies land where they should and
+         // match. Doesn't interrupt an epoch being reassembled.
+         elapsedUS = rcf.ArrivalUS - state.rxClockUS;
+         if(state.rxGossipAt == 0 ||
+               elapsedUS < state.rxGossipAt * (BEACON_FRAME_SPACING_US - BEACON_SPACING_SLACK_US) ||
+               elapsedUS > state.rxGossipAt * (BEACON_FRAME_SPACING_US + BEACON_SPACING_SLACK_US) ||
+               (state.rxGossipAt == 2 && raw != state.rxGossip)) {
+            state.rxGossipAt = 0;
+            metrics_Count(MID_FramesRejected);
+            return false;
+         }
+         if(state.rxGossipAt++ == 1) {
+            state.rxGossip = raw;
+            return false;
+         }
+         state.rxGossipAt = 0;
+
+         beacon->type = BT_Gossip;
+         beacon->version = (raw >> BEACON_VERSION_SHIFT) & GOSSIP_VERSION_MASK;
+         beacon->setting = (raw >> BEACON_SETTING_SHIFT) & GOSSIP_SETTING_MASK;
+         metrics_Count(MID_BeaconsRx);
+         return true;
    }
-   return false;
+}
+
+/*
+ * Fill in a frame's check bits from the rest of it.
+ */
+uint16_t beacon_AddCheck(uint16_t frame) {
+   return (frame & ~BEACON_CHECK_MASK) | beacon_Check(frame);
+}
+
+/*
+ * Whether a frame's check bits match, i.e. it's likely one somebody sent.
+ */
+bool beacon_CheckPasses(uint16_t raw) {
+   return (raw & BEACON_CHECK_MASK) == beacon_Check(raw);
 }
 
 uint32_t beacon_LastReceived(void) {
    return state.lastReceived;
 }
+
+/*
+ * Part way through a burst, frames or the gaps between them.
+ */
+bool beacon_IsSending(void) {
+   return state.txPhase != TXP_Idle;
+}
+
+/*
+ * Heard a frame recently enough that more of its burst may be on the way.
+ */
+bool beacon_IsReceiving(void) {
+   return HAL_GetTick() - state.lastReceived < BEACON_RX_BURST_MS;
+}
+
+/*
+ * A frame is coming in, or one just did and the next of its burst could be
+ * due after the gap. Anything we started now would collide with it.
+ */
+bool beacon_ChannelBusy(void) {
+   return ir_IsReceiving() || HAL_GetTick() - state.lastReceived <= BEACON_TX_GAP_MS;
+}
+
+/*
+ * The CRC of everything but the check bits, MSB first.
+ */
+static uint8_t beacon_Check(uint16_t frame) {
+   uint8_t crc = BEACON_CHECK_INIT;
+   uint8_t feedback;
+   int i;
+
+   for(i = BEACON_FRAME_BITS - 1; i >= BEACON_CHECK_BITS; i--) {
+      feedback = ((crc >> (BEACON_CHECK_BITS - 1)) ^ (frame >> i)) & 1;
+      crc = (crc << 1) & BEACON_CHECK_MASK;
+      if(feedback) {
+         crc ^= BEACON_CHECK_POLY;
+      }
+   }
+   return crc;
+}
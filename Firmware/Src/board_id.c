@@ -1,7 +1,9 @@
 #include "board_id.h"
 
 //FIXME rm
-#include "iprintf.h"
+#include "log.h"
+
+#include "stm32f0xx.h"
 
 #include <stdint.h>
 
@@ -13,16 +15,15 @@
  * Next 8 are wafer number
  * Next 56 are lot number in ASCII
  */
-#define UNIQUE_ID_REG_ADDR            0x1FFFF7AC
+#define UNIQUE_ID_REG_ADDR            UID_BASE       // 0x1FFFF7AC
 #define UNIQUE_ID_REG_GET8(x)        ((x >= 0 && x < 12) ? (*(uint8_t *) (UNIQUE_ID_REG_ADDR + (x))) : 0)
+#define UNIQUE_ID_REG_GET32(x)       ((x >= 0 && x < 3) ? (*(uint32_t *) (UNIQUE_ID_REG_ADDR + (4 * (x)))) : 0)
 
-uint32_t bid_GetID(void) {
-   int i;
-   for(i = 0; i < 12; i++) {
-      //FIXME rm printing
-      iprintf("ID #%d - 0x%x (%c)\n", i, UNIQUE_ID_REG_GET8(i), UNIQUE_ID_REG_GET8(i));
-   }
+// 32 bit FNV-1a
+#define FNV_OFFSET_BASIS              0x811C9DC5
+#define FNV_PRIME                     0x01000193
 
+uint32_t bid_GetID(void) {
    // use wafer X/Y for ID. The tray I got all has the same lot number
    return   UNIQUE_ID_REG_GET8(0) << 0 |
             UNIQUE_ID_REG_GET8(1) << 8 |
@@ -30,3 +31,27 @@ uint32_t bid_GetID(void) {
             UNIQUE_ID_REG_GET8(3) << 24;
 }
 
+/**
+ * Hash all 96 bits of the unique ID together, so that boards which share a
+ * wafer position (or a lot) still come out different. Quiet, unlike bid_GetID().
+ */
+uint32_t bid_GetHash(void) {
+   uint32_t hash = FNV_OFFSET_BASIS;
+   int i;
+
+   for(i = 0; i < 12; i++) {
+      hash ^= UNIQUE_ID_REG_GET8(i);
+      hash *= FNV_PRIME;
+   }
+   return hash;
+}
+
+/**
+ * Log all 12 bytes of the unique ID, as its three words in one line (the first
+ * is bid_GetID()).
+ */
+void bid_Report(void) {
+   LOG_DEBUG("UID %x %x %x\r\n", (unsigned)UNIQUE_ID_REG_GET32(0),
+         (unsigned)UNIQUE_ID_REG_GET32(1), (unsigned)UNIQUE_ID_REG_GET32(2));
+}
+
@@ -0,0 +1,36 @@
+/*
+ * See boot.h. Like metrics, the report goes out through iprintf() whatever the
+ * log level.
+ */
+#include "boot.h"
+#include "platform_hw.h"
+#include "iprintf.h"
+
+#include <stdint.h>
+
+static struct boot_State {
+   uint32_t us[BS_Count];
+} state;
+
+static char const * const Names[BS_Count] = {
+   [BS_HAL]          = "hal",
+   [BS_Platform]     = "platform",
+   [BS_LED]          = "led",
+   [BS_FirstFrame]   = "frame",
+   [BS_Seed]         = "seed",
+   [BS_Pattern]      = "pattern",
+   [BS_Power]        = "power",
+   [BS_Ready]        = "ready",
+};
+
+void boot_Mark(enum boot_Stage stage) {
+   state.us[stage] = platformHW_GetMicros();
+}
+
+void boot_Report(void) {
+   iprintf("BOOT");
+   for(int i = 0; i < BS_Count; i++) {
+      iprintf(" %s=%d", Names[i], (int)state.us[i]);
+   }
+   iprintf("\r\n");
+}
@@ -0,0 +1,94 @@
+#include "clock_trim.h"
+#include "platform_hw.h"
+#include "ir_encode.h"
+#include "rng.h"
+#include "log.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// What a peer's half bit would measure if both of our clocks were perfect. us * 16
+#define NOMINAL_HALF_BIT_Q4         ((((IR_HALF_BIT_PERIOD) + 1) * 16) / ((IR_HALF_BIT_PERIOD_KHZ) / 1000))
+
+// Anything further off than this is a bad frame, not a bad clock. The HSI is
+// only specced to a few % over temperature.
+#define MAX_ERROR_Q4                (NOMINAL_HALF_BIT_Q4 / 25)
+
+// One trim step moves the HSI ~0.5%. Only step once the average is more than
+// three quarters of a step off. Steps that coarse can't get a whole crowd
+// within half a step of each other, and with a tighter threshold someone is
+// always stepping past someone else and the crowd's clock wanders off with
+// them. The beacon phase loop takes out what's left.
+#define STEP_THRESHOLD_Q4           ((NOMINAL_HALF_BIT_Q4 * 3) / 800)
+
+// Frames to collect before acting on the average, and the most it's taken
+// over (older ones count half as much each time it fills)
+#define MIN_FRAMES                  (16)
+#define MAX_FRAMES                  (64)
+
+struct ct_State {
+   // measured half bits since the last time we moved the trim, us * 16
+   int32_t     sum;
+   uint16_t    frames;
+   // trim steps taken that nobody's asked about yet
+   int8_t      steps;
+};
+static struct ct_State state;
+
+void ct_Init(void) {
+   memset(&state, 0, sizeof(state));
+}
+
+/*
+ * Feed in a peer's half bit length as we measured it. Everyone averaging the
+ * clocks of everyone they hear walks the whole crowd to its mean clock.
+ */
+void ct_SawFrame(uint16_t halfBitQ4) {
+   int32_t average, error;
+   uint8_t trim;
+
+   if(halfBitQ4 == 0 || abs((int32_t)halfBitQ4 - NOMINAL_HALF_BIT_Q4) > MAX_ERROR_Q4) {
+      return;
+   }
+
+   if(state.frames == MAX_FRAMES) {
+      state.sum /= 2;
+      state.frames /= 2;
+   }
+   state.sum += halfBitQ4;
+   state.frames++;
+
+   if(state.frames < MIN_FRAMES) {
+      return;
+   }
+
+   // Their bits look long if our clock is fast, so trim the other way
+   average = state.sum / state.frames;
+   error = average - NOMINAL_HALF_BIT_Q4;
+   if(abs(error) > STEP_THRESHOLD_Q4) {
+      // Whoever we're hearing has likely just seen the same thing the other
+      // way round. If we both step we've only swapped places, so only take it
+      // half the time and look again either way.
+      if(rng_Below(2)) {
+         state.steps += (error > 0) ? -1 : 1;
+         trim = platformHW_TrimHSI((error > 0) ? -1 : 1);
+         LOG_INFO("HSI trim to %d (half bit %d/16us)\r\n", trim, (int)average);
+      }
+
+      // our ruler just changed length (or soon will), start measuring again
+      state.sum = 0;
+      state.frames = 0;
+   }
+}
+
+/*
+ * How many steps we've trimmed up by (down is negative) since the last call.
+ * Anything keeping time against other badges has to make up for them.
+ */
+int8_t ct_TakeSteps(void) {
+   int8_t const steps = state.steps;
+
+   state.steps = 0;
+   return steps;
+}
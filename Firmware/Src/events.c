@@ -0,0 +1,182 @@
+/*
+ * See events.h. SysTick wakes the core every ms whatever else is going on, so
+ * deadlines are met to within a tick without a timer of their own. In stop
+ * mode the RTC's alarm takes over (see platformHW_Stop()).
+ */
+#include "events.h"
+#include "beacons.h"
+#include "platform_hw.h"
+#include "metrics.h"
+#include "stm32f0xx.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Not worth stopping for less
+#define EVENTS_STOP_MIN_US       (2000)
+// Out of stop this long after IR or the UART woke us. A newcomer's beacon
+// wakes us and is lost, so stay up past the longest gap between beacons to
+// hear its next one.
+#define EVENTS_STOP_HOLDOFF_US   ((BEACON_MAX_GAP_MS + 1000) * 1000UL)
+// Recalibrate stop's timing this often
+#define EVENTS_CALIBRATE_US      (60000000)
+
+static struct events_State {
+   volatile uint32_t pending;
+   // deadlines, and which of them are set
+   uint32_t          atUS[ED_Count];
+   uint32_t          armed;
+   // sleep short of a whole ms, carried over to the next time
+   uint32_t          sleptUS;
+
+   bool              stopAllowed;
+   // kept out of stop since
+   bool              holdoff;
+   uint32_t          holdoffStartUS;
+   bool              calibrated;
+   uint32_t          calibratedUS;
+} state;
+
+static uint32_t events_TimeToDeadline(uint32_t nowUS);
+
+/*
+ * Nothing pending, and every deadline due so each gets a first look.
+ */
+void events_Init(void) {
+   state.pending = 0;
+   state.armed = 0;
+   state.sleptUS = 0;
+   state.stopAllowed = false;
+   state.holdoff = false;
+   state.calibrated = false;
+
+   for(int i = 0; i < ED_Count; i++) {
+      events_SetDeadline(i, 0, 0);
+   }
+}
+
+/*
+ * From anywhere, ISRs at any priority included.
+ */
+void events_Post(uint32_t events) {
+   uint32_t const primask = __get_PRIMASK();
+
+   __disable_irq();
+   state.pending |= events;
+   __set_PRIMASK(primask);
+}
+
+/*
+ * Everything posted since last time.
+ */
+uint32_t events_Take(void) {
+   uint32_t const primask = __get_PRIMASK();
+   uint32_t events;
+
+   __disable_irq();
+   events = state.pending;
+   state.pending = 0;
+   __set_PRIMASK(primask);
+
+   return events;
+}
+
+/*
+ * Due inUS from nowUS, or never with EVENTS_NEVER.
+ */
+void events_SetDeadline(enum events_Deadline id, uint32_t nowUS, uint32_t inUS) {
+   if(inUS == EVENTS_NEVER) {
+      state.armed &= ~(1 << id);
+      return;
+   }
+
+   state.atUS[id] = nowUS + inUS;
+   state.armed |= (1 << id);
+}
+
+bool events_Due(enum events_Deadline id, uint32_t nowUS) {
+   return (state.armed & (1 << id)) && (int32_t)(nowUS - state.atUS[id]) >= 0;
+}
+
+/*
+ * Whether events_Wait() may use stop mode. Nothing can be going on that needs
+ * the clocks running: IR going out, a beacon burst coming in.
+ */
+void events_AllowStop(bool allow) {
+   state.stopAllowed = allow;
+}
+
+/*
+ * Sleep until something's posted or a deadline comes up. Interrupts are off
+ * between looking for events and the WFI, so one that comes in right then
+ * still wakes us (and runs once they're back on). Returns how long we slept.
+ */
+uint32_t events_Wait(void) {
+   uint32_t start = platformHW_GetMicros();
+   uint32_t now = start;
+   uint32_t untilUS, wake;
+
+   if(state.holdoff && now - state.holdoffStartUS >= EVENTS_STOP_HOLDOFF_US) {
+      state.holdoff = false;
+   }
+   if(state.stopAllowed && !state.holdoff &&
+         (!state.calibrated || now - state.calibratedUS >= EVENTS_CALIBRATE_US)) {
+      platformHW_CalibrateStop();
+      state.calibrated = true;
+      state.calibratedUS = now;
+      start = now = platformHW_GetMicros();
+   }
+
+   while((untilUS = events_TimeToDeadline(now)) != 0) {
+      __disable_irq();
+      if(state.pending) {
+         __enable_irq();
+         break;
+      }
+
+      wake = 0;
+      if(state.stopAllowed && !state.holdoff && state.calibrated && untilUS >= EVENTS_STOP_MIN_US) {
+         wake = platformHW_Stop(untilUS);
+      }
+      if(!wake) {
+         __WFI();
+      }
+      __enable_irq();
+
+      now = platformHW_GetMicros();
+      if(wake & (PLATFORMHW_WAKE_IR | PLATFORMHW_WAKE_UART)) {
+         state.holdoff = true;
+         state.holdoffStartUS = now;
+      }
+   }
+
+   // Asleep (ISRs aside) the rest of the time, so that's the duty cycle
+   state.sleptUS += now - start;
+   metrics_CountN(MID_SleepMS, state.sleptUS / 1000);
+   state.sleptUS %= 1000;
+
+   return now - start;
+}
+
+/*
+ * Until the nearest deadline, 0 if one's already due.
+ */
+static uint32_t events_TimeToDeadline(uint32_t nowUS) {
+   uint32_t next = EVENTS_NEVER;
+   int32_t left;
+
+   for(int i = 0; i < ED_Count; i++) {
+      if(!(state.armed & (1 << i))) {
+         continue;
+      }
+
+      left = (int32_t)(state.atUS[i] - nowUS);
+      if(left <= 0) {
+         return 0;
+      }
+      if((uint32_t)left < next) {
+         next = left;
+      }
+   }
+   return next;
+}
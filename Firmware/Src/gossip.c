@@ -0,0 +1,130 @@
+/*
+ * A cut down Trickle (RFC 6206), counted in our own beacons instead of time.
+ * Every beacon interval we advertise the setting unless we already heard enough
+ * neighbors do it. While everyone agrees we wait longer and longer between
+ * attempts. Hearing anything different starts that over, so changes spread
+ * fast and a settled room goes quiet.
+ */
+#include "gossip.h"
+#include "log.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Stay quiet after hearing this many neighbors advertise what we have
+#define GOSSIP_REDUNDANCY        (2)
+// Longest wait between attempts once everyone agrees, in beacons
+#define GOSSIP_MAX_WAIT          (16)
+
+struct gossip_State {
+   // nothing originated or heard yet, so version and setting mean nothing
+   bool        unset;
+   uint8_t     version;
+   uint8_t     setting;
+
+   // beacons to go before we consider advertising, and how many that was
+   uint8_t     wait;
+   uint8_t     countdown;
+   // neighbors heard saying the same thing since our last attempt
+   uint8_t     consistent;
+};
+static struct gossip_State state;
+
+static void gossip_Reset(void);
+
+void gossip_Init(void) {
+   memset(&state, 0, sizeof(state));
+   state.unset = true;
+   state.wait = 1;
+   // nothing worth spreading until someone changes something
+   state.countdown = GOSSIP_MAX_WAIT;
+}
+
+/*
+ * Change the setting here, and start telling everyone.
+ */
+void gossip_Originate(uint8_t setting) {
+   state.unset = false;
+   state.version = (state.version + 1) & GOSSIP_VERSION_MASK;
+   state.setting = setting & GOSSIP_SETTING_MASK;
+
+   LOG_INFO("Gossip: now v%d = %d\r\n", state.version, state.setting);
+   gossip_Reset();
+}
+
+/*
+ * Returns true if this changed our setting.
+ */
+bool gossip_Heard(uint8_t version, uint8_t setting) {
+   uint8_t const ahead = (version - state.version) & GOSSIP_VERSION_MASK;
+
+   if(!state.unset && ahead == 0 && setting == state.setting) {
+      state.consistent++;
+      return false;
+   }
+
+   // Anything further ahead than half the version space is actually behind.
+   // Two badges can press on the same version at once, so the higher setting
+   // settles it.
+   if(state.unset || (ahead != 0 && ahead <= (GOSSIP_VERSION_MASK / 2)) ||
+         (ahead == 0 && setting > state.setting)) {
+      state.unset = false;
+      state.version = version;
+      state.setting = setting;
+
+      LOG_INFO("Gossip: adopted v%d = %d\r\n", state.version, state.setting);
+      gossip_Reset();
+      return true;
+   }
+
+   // They're out of date, or lost the tie. Make sure we get around to telling
+   // them.
+   gossip_Reset();
+   return false;
+}
+
+/*
+ * Called once per beacon clock tick. Returns true (and what to say) if this
+ * tick's beacon should carry the setting.
+ */
+bool gossip_ShouldAdvertise(uint8_t *version, uint8_t *setting) {
+   bool advertise = false;
+
+   if(state.unset) {
+      return false;
+   }
+
+   if(state.countdown > 0) {
+      state.countdown--;
+   }
+   if(state.countdown > 0) {
+      return false;
+   }
+
+   if(state.consistent < GOSSIP_REDUNDANCY) {
+      *version = state.version;
+      *setting = state.setting;
+      advertise = true;
+   }
+
+   // Either way, all quiet this round. Back off.
+   state.consistent = 0;
+   state.wait = (state.wait * 2 > GOSSIP_MAX_WAIT) ? GOSSIP_MAX_WAIT : state.wait * 2;
+   state.countdown = state.wait;
+
+   return advertise;
+}
+
+uint8_t gossip_Setting(void) {
+   return state.setting;
+}
+
+/*
+ * Something changed, go back to advertising every beacon.
+ */
+static void gossip_Reset(void) {
+   state.wait = 1;
+   state.countdown = 1;
+   state.consistent = 0;
+}
@@ -1,18 +1,156 @@
 /******************************************************************************
 *This file is for iprintf()
 *The iprintf() is a simple printf() and only can print string with %s,%d,%c,%x.
+*
+*Characters go into a ring and USART1's TXE interrupt sends them, so printing
+*never waits on the wire. When the ring is full they're dropped and counted,
+*unless iprintf_Blocking() is on.
+*The last byte received is kept for iprintf_GetChar().
 *******************************************************************************/
 #include "iprintf.h"
+#include "events.h"
 #include "stm32f0xx_hal.h"
 
 #include <stdint.h>
+#include <stdbool.h>
 
-extern UART_HandleTypeDef huart1;
+// Power of 2. ~22ms of backlog at 115200
+#define IPRINTF_TX_BUFFER_SIZE   (256)
 
+static struct iprintf_State {
+   uint8_t           tx[IPRINTF_TX_BUFFER_SIZE];
+   // Free running, wrapped on use. Only iputc() moves head, only the ISR tail
+   volatile uint16_t head;
+   volatile uint16_t tail;
+   volatile uint32_t dropped;
+   volatile uint8_t  rx;
+   volatile bool     rxFull;
+   bool              blocking;
+} state;
+
+static void iprintf_WaitForRoom(uint16_t len, uint32_t primask);
+
+/*
+ * Callable from anywhere, ISRs included. Interrupts are held off for the few
+ * instructions it takes to claim a slot, since the M0 has no atomics and an ISR
+ * may be printing over the main loop.
+ */
 static void iputc(char ch)
 {
-   //TODO what should this timeout be?
-   HAL_UART_Transmit(&huart1, (uint8_t*)&ch, 1, 10000);
+   uint32_t const primask = __get_PRIMASK();
+
+   iprintf_WaitForRoom(1, primask);
+   __disable_irq();
+   if((uint16_t)(state.head - state.tail) < IPRINTF_TX_BUFFER_SIZE) {
+      state.tx[state.head % IPRINTF_TX_BUFFER_SIZE] = ch;
+      state.head++;
+      USART1->CR1 |= USART_CR1_TXEIE;
+   } else {
+      state.dropped++;
+   }
+   __set_PRIMASK(primask);
+}
+
+/*
+ * Bytes that have to go out together or not at all.
+ */
+void iprintf_Write(uint8_t const *data, uint16_t len)
+{
+   uint32_t const primask = __get_PRIMASK();
+
+   iprintf_WaitForRoom(len, primask);
+   __disable_irq();
+   if((uint16_t)(state.head - state.tail) <= IPRINTF_TX_BUFFER_SIZE - len) {
+      for(uint16_t i = 0; i < len; i++) {
+         state.tx[state.head % IPRINTF_TX_BUFFER_SIZE] = data[i];
+         state.head++;
+      }
+      USART1->CR1 |= USART_CR1_TXEIE;
+   } else {
+      state.dropped += len;
+   }
+   __set_PRIMASK(primask);
+}
+
+/*
+ * USART1 has a byte for us, or is ready for another.
+ */
+void iprintf_UartISR(void)
+{
+   uint32_t const isr = USART1->ISR;
+
+   // Reading RDR clears RXNE. An unread byte is simply replaced by the next
+   if(isr & USART_ISR_RXNE) {
+      state.rx = USART1->RDR;
+      state.rxFull = true;
+      events_Post(EV_Request);
+   }
+   if(isr & USART_ISR_ORE) {
+      USART1->ICR = USART_ICR_ORECF;
+   }
+
+   if(!(isr & USART_ISR_TXE) || !(USART1->CR1 & USART_CR1_TXEIE)) {
+      return;
+   }
+
+   if(state.tail != state.head) {
+      USART1->TDR = state.tx[state.tail % IPRINTF_TX_BUFFER_SIZE];
+      state.tail++;
+   }
+
+   // Checked with interrupts off so a byte from a higher priority ISR can't
+   // land between the test and turning the interrupt off
+   __disable_irq();
+   if(state.tail == state.head) {
+      USART1->CR1 &= ~USART_CR1_TXEIE;
+   }
+   __enable_irq();
+}
+
+/*
+ * Wait until everything printed so far is out on the wire. Needs USART1's
+ * interrupt to run, so not from ISRs or with interrupts off.
+ */
+void iprintf_Flush(void)
+{
+   while(state.tail != state.head) {
+   }
+   while(!(USART1->ISR & USART_ISR_TC)) {
+   }
+}
+
+void iprintf_Blocking(bool on)
+{
+   state.blocking = on;
+}
+
+bool iprintf_GetChar(uint8_t *ch)
+{
+   if(!state.rxFull) {
+      return false;
+   }
+   *ch = state.rx;
+   state.rxFull = false;
+   return true;
+}
+
+uint32_t iprintf_GetDropped(void)
+{
+   return state.dropped;
+}
+
+/*
+ * With blocking on, wait until len more bytes fit. Only where USART1's
+ * interrupt can get in to make the room: not in an ISR, nor with interrupts
+ * off. An ISR printing in between can still take it, and then we drop.
+ */
+static void iprintf_WaitForRoom(uint16_t len, uint32_t primask)
+{
+   if(!state.blocking || __get_IPSR() != 0 || primask != 0) {
+      return;
+   }
+   while((uint16_t)(state.head - state.tail) > IPRINTF_TX_BUFFER_SIZE - len) {
+   }
 }
 
 static uint8_t* change(uint32_t Index)
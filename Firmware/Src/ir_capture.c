@@ -0,0 +1,85 @@
+/*
+ * See ir_capture.h. Edges are packed into 16 bits, the gap in the top 15 and
+ * the level in the bottom one, so gaps stop at 32ms. Anything that long is
+ * well past the decoder's timeout and replays the same.
+ */
+#include "ir_capture.h"
+#include "iprintf.h"
+#include "utilities.h"
+#include "stm32f0xx_hal.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef IR_CAPTURE_ENABLED
+
+// 1KB of RAM, a dozen or so frames' worth
+#ifndef IR_CAPTURE_EDGES
+#define IR_CAPTURE_EDGES         (512)
+#endif
+#define IR_CAPTURE_MAX_US        (0x7FFF)
+
+static struct ir_CaptureState {
+   uint16_t          edges[IR_CAPTURE_EDGES];
+   uint16_t          next;
+   uint16_t          count;
+   // TIM3 rolled over since the last edge this long ago
+   uint32_t          quietUS;
+   // not recording while it's being sent
+   volatile bool     paused;
+} state;
+
+/*
+ * From TIM3's capture interrupt. TIM3 counts microseconds and is reset by
+ * every edge, so ticks is the time since the last one (or the last rollover).
+ */
+void ir_CaptureEdge(uint16_t ticks, uint8_t level) {
+   uint32_t us;
+
+   if(state.paused) {
+      // the first edge after will look like it came out of nowhere
+      state.quietUS = IR_CAPTURE_MAX_US;
+      return;
+   }
+
+   us = MIN(state.quietUS + ticks, IR_CAPTURE_MAX_US);
+   state.quietUS = 0;
+
+   state.edges[state.next] = (us << 1) | (level ? 1 : 0);
+   state.next = (state.next + 1) % IR_CAPTURE_EDGES;
+   if(state.count < IR_CAPTURE_EDGES) {
+      state.count++;
+   }
+}
+
+/*
+ * From TIM3's update interrupt, when it's gone a whole period with no edge.
+ */
+void ir_CaptureTimeout(void) {
+   if(state.quietUS < IR_CAPTURE_MAX_US) {
+      state.quietUS += TIM3->ARR + 1;
+   }
+}
+
+/*
+ * Everything recorded so far, oldest first, then start over.
+ */
+void ir_CaptureReport(void) {
+   uint16_t i;
+
+   state.paused = true;
+
+   iprintf("# IR capture %d edges\r\n", state.count);
+
+   i = (state.next + IR_CAPTURE_EDGES - state.count) % IR_CAPTURE_EDGES;
+   for(; state.count > 0; state.count--) {
+      iprintf("%d %d\r\n", state.edges[i] >> 1, state.edges[i] & 1);
+      i = (i + 1) % IR_CAPTURE_EDGES;
+   }
+
+   iprintf("# IR capture end\r\n");
+
+   state.paused = false;
+}
+
+#endif
@@ -3,7 +3,10 @@
  */
 
 #include "ir_decode.h"
-#include "iprintf.h"
+#include "platform_hw.h"
+#include "log.h"
+#include "metrics.h"
+#include "events.h"
 
 #include "stm32f0xx_hal.h"
 #include "stm32f0xx_hal_tim.h"
@@ -25,7 +28,7 @@
 /* Packet struct for reception*/
 #define RC5_PACKET_STATUS_EMPTY              false 
 
-#define TIM_PRESCALER                        47                       /* !< TIM prescaler */
+#define TIM_COUNTER_HZ                       1000000                  /* !< TIM3 counter clock, whatever PCLK is */
 
 typedef struct
 {
@@ -33,6 +36,11 @@ typedef struct
    __IO bool     status;   /*!< RC5 status */
    __IO uint8_t  lastBit;  /*!< RC5 last bit */
    __IO uint8_t  bitCount; /*!< RC5 bit count */
+   __IO uint32_t startUS;  /*!< RC5 first edge time */
+   __IO uint16_t spanTicks;    /*!< Time from the first edge to the last falling edge */
+   __IO uint8_t  spanHalfBits; /*!< Half bits covered by spanTicks */
+   __IO uint16_t runTicks;     /*!< Time from the first edge to the latest edge */
+   __IO uint8_t  runHalfBits;  /*!< Half bits covered by runTicks */
 } tRC5_packet;
 
 enum RC5_lastBitType
@@ -67,6 +75,11 @@ TIM_HandleTypeDef htim3;
 __IO bool RC5FrameReceived = false; /*!< RC5 Frame state */ 
 __IO tRC5_packet   RC5TmpPacket;          /*!< First empty packet */
 
+/* Completed frame, latched so the idle timeout can't wipe it before it's read */
+static __IO uint16_t RC5RxData;
+static __IO uint32_t RC5RxArrivalUS;
+static __IO uint16_t RC5RxHalfBitQ4;
+
 /* RC5  bits time definitions */
 static uint16_t  RC5MinT = 0;
 static uint16_t  RC5MaxT = 0;
@@ -80,6 +93,10 @@ static uint8_t RC5_GetPulseLength (uint16_t pulseLength);
 static void RC5_modifyLastBit(tRC5_lastBitType bit);
 static void RC5_WriteBit(uint8_t bitVal);
 static uint32_t TIM_GetCounterCLKValue(void);
+static uint32_t TIM_GetInputCLKValue(void);
+static uint32_t TIM_GetPrescaler(void);
+static uint32_t RC5_TicksToUS(uint32_t ticks);
+static void RC5_MeasurePulse(uint16_t rawPulseLength, uint8_t pulse, uint8_t edge);
 
 /**
  * @brief  Initialize the RC5 decoder module ( Time range)
@@ -96,29 +113,27 @@ void ir_InitDecode(void)
    //calculate timeouts
    TIMCLKValueKHz = TIM_GetCounterCLKValue()/1000;
    RC5TimeOut = TIMCLKValueKHz * (RC5_TIME_OUT_US / 1000);
-   iprintf("Value KHz = %d\r\n", TIMCLKValueKHz);
-   iprintf("RC5 timeout = %d\r\n", RC5TimeOut);
 
    htim3.Instance = TIM3;
-   htim3.Init.Prescaler = 47;
+   htim3.Init.Prescaler = TIM_GetPrescaler();
    htim3.Init.CounterMode = TIM_COUNTERMODE_UP;
    htim3.Init.Period = RC5TimeOut;
    htim3.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
    htim3.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
    if (HAL_TIM_Base_Init(&htim3) != HAL_OK)
    {
-      iprintf("ERROR\r\n");
+      LOG_ERROR("ERROR\r\n");
    }
 
    sClockSourceConfig.ClockSource = TIM_CLOCKSOURCE_INTERNAL;
    if (HAL_TIM_ConfigClockSource(&htim3, &sClockSourceConfig) != HAL_OK)
    {
-      iprintf("ERROR\r\n");
+      LOG_ERROR("ERROR\r\n");
    }
 
    if (HAL_TIM_IC_Init(&htim3) != HAL_OK)
    {
-      iprintf("ERROR\r\n");
+      LOG_ERROR("ERROR\r\n");
    }
 
    sSlaveConfig.SlaveMode = TIM_SLAVEMODE_RESET;
@@ -127,14 +142,14 @@ void ir_InitDecode(void)
    sSlaveConfig.TriggerFilter = 0;
    if (HAL_TIM_SlaveConfigSynchronization(&htim3, &sSlaveConfig) != HAL_OK)
    {
-      iprintf("ERROR\r\n");
+      LOG_ERROR("ERROR\r\n");
    }
 
    sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
    sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_ENABLE;
    if (HAL_TIMEx_MasterConfigSynchronization(&htim3, &sMasterConfig) != HAL_OK)
    {
-      iprintf("ERROR\r\n");
+      LOG_ERROR("ERROR\r\n");
    }
 
    sConfigIC.ICPolarity = TIM_INPUTCHANNELPOLARITY_BOTHEDGE;
@@ -143,7 +158,7 @@ void ir_InitDecode(void)
    sConfigIC.ICFilter = 0;
    if (HAL_TIM_IC_ConfigChannel(&htim3, &sConfigIC, TIM_CHANNEL_1) != HAL_OK)
    {
-      iprintf("ERROR\r\n");
+      LOG_ERROR("ERROR\r\n");
    }
 
    /* Enable TIM Update Event Interrupt Request */
@@ -156,9 +171,6 @@ void ir_InitDecode(void)
    RC5Min2T = (2 * RC5_T_US - RC5_T_TOLERANCE_US) * TIMCLKValueKHz / 1000;
    RC5Max2T = (2 * RC5_T_US + RC5_T_TOLERANCE_US) * TIMCLKValueKHz / 1000;
 
-   iprintf("MinT = %d, MaxT = %d\r\n", RC5MinT, RC5MaxT);
-   iprintf("Min2T = %d, Max2T = %d\r\n", RC5Min2T, RC5Max2T);
-
    /* Default state */
    ir_ResetPacket();
 
@@ -180,6 +192,27 @@ void ir_DecodeEnable(void) {
    HAL_TIM_IC_Start_IT(&htim3, TIM_CHANNEL_1);
 }
 
+/**
+ * Keep TIM3 at TIM_COUNTER_HZ after PCLK changed. The prescaler is buffered
+ * and only taken up at the next edge or timeout, so change clocks between
+ * frames: a pulse that's being timed across it comes out wrong.
+ */
+void ir_DecodeClockChanged(void) {
+   htim3.Init.Prescaler = TIM_GetPrescaler();
+   htim3.Instance->PSC = htim3.Init.Prescaler;
+}
+
+/**
+ * Log the timer rate and the pulse ranges ir_InitDecode() worked out.
+ */
+void ir_DecodeReport(void)
+{
+   LOG_DEBUG("Value KHz = %d\r\n", (int)TIMCLKValueKHz);
+   LOG_DEBUG("RC5 timeout = %d\r\n", RC5TimeOut);
+   LOG_DEBUG("MinT = %d, MaxT = %d\r\n", RC5MinT, RC5MaxT);
+   LOG_DEBUG("Min2T = %d, Max2T = %d\r\n", RC5Min2T, RC5Max2T);
+}
+
 /**
  * @brief  Decode the IR frame (ADDRESS, COMMAND) when all the frame is
  *         received, the IRFrameReceived will equal to YES.
@@ -200,14 +233,16 @@ bool ir_GetDecoded(uint16_t *raw, RC5_Frame_TypeDef *rc5_frame)
    if(RC5FrameReceived)
    {
       if(raw) {
-         *raw = RC5TmpPacket.data;
+         *raw = RC5RxData;
       }
       if(rc5_frame) {
          /* RC5 frame field decoding */
-         rc5_frame->Address = (RC5TmpPacket.data >> 6) & 0x1F;
-         rc5_frame->Command = (RC5TmpPacket.data) & 0x3F; 
-         rc5_frame->FieldBit = (RC5TmpPacket.data >> 12) & 0x1;
-         rc5_frame->ToggleBit = (RC5TmpPacket.data >> 11) & 0x1;
+         rc5_frame->Address = (RC5RxData >> 6) & 0x1F;
+         rc5_frame->Command = (RC5RxData) & 0x3F; 
+         rc5_frame->FieldBit = (RC5RxData >> 12) & 0x1;
+         rc5_frame->ToggleBit = (RC5RxData >> 11) & 0x1;
+         rc5_frame->ArrivalUS = RC5RxArrivalUS;
+         rc5_frame->HalfBitQ4 = RC5RxHalfBitQ4;
 
          /* Check if command ranges between 64 to 127:Upper Field */
          if (rc5_frame->FieldBit == 0x00)
@@ -216,11 +251,9 @@ bool ir_GetDecoded(uint16_t *raw, RC5_Frame_TypeDef *rc5_frame)
          }
       }
 
-      /* Default state */
+      /* Default state. The packet itself was reset when the frame was latched */
       RC5FrameReceived = false;
 
-      ir_ResetPacket();
-
       return true;
    }
    return false;
@@ -237,6 +270,33 @@ void ir_ResetPacket(void)
    RC5TmpPacket.bitCount = RC5_PACKET_BIT_COUNT - 1;
    RC5TmpPacket.lastBit = RC5_ONE;
    RC5TmpPacket.status = RC5_PACKET_STATUS_EMPTY;
+   RC5TmpPacket.spanTicks = 0;
+   RC5TmpPacket.spanHalfBits = 0;
+   RC5TmpPacket.runTicks = 0;
+   RC5TmpPacket.runHalfBits = 0;
+}
+
+/**
+ * Part way through a frame.
+ */
+bool ir_IsReceiving(void)
+{
+   return (RC5TmpPacket.status != RC5_PACKET_STATUS_EMPTY);
+}
+
+/**
+ * @brief  The line went quiet for RC5TimeOut. Normal between frames, but not
+ *         part way through one.
+ * @param  None
+ * @retval None
+ */
+void ir_PacketTimeout(void)
+{
+   if (RC5TmpPacket.status != RC5_PACKET_STATUS_EMPTY)
+   {
+      metrics_Count(MID_DecodeTimeout);
+   }
+   ir_ResetPacket();
 }
 
 /**
@@ -265,6 +325,8 @@ void ir_DataSampling(uint16_t rawPulseLength, uint8_t edge)
 
       if (pulse <= RC5_2T_TIME) 
       {
+         RC5_MeasurePulse(rawPulseLength, pulse, edge);
+
          /* Bit determination by the rising edge */
          tmpLastBit = RC5_logicTableRisingEdge[RC5TmpPacket.lastBit][pulse];
          RC5_modifyLastBit (tmpLastBit);
@@ -273,6 +335,7 @@ void ir_DataSampling(uint16_t rawPulseLength, uint8_t edge)
       {
          iprintf("R");
 
+         metrics_Count(MID_DecodeBadPulse);
          ir_ResetPacket();
       }
    } 
@@ -286,11 +349,17 @@ void ir_DataSampling(uint16_t rawPulseLength, uint8_t edge)
          iprintf("F");
 
          RC5TmpPacket.status = true;
+
+         /* The counter is reset by every edge (slave reset mode) so it holds
+            how long ago this edge was. Timestamp the edge, not the ISR. */
+         RC5TmpPacket.startUS = platformHW_GetMicros() - RC5_TicksToUS(__HAL_TIM_GET_COUNTER(&htim3));
       }
       else	
       {
          if (pulse <= RC5_2T_TIME) 
          { 
+            RC5_MeasurePulse(rawPulseLength, pulse, edge);
+
             /* Bit determination by the falling edge */
             tmpLastBit = RC5_logicTableFallingEdge[RC5TmpPacket.lastBit][pulse];
             RC5_modifyLastBit(tmpLastBit);
@@ -299,6 +368,7 @@ void ir_DataSampling(uint16_t rawPulseLength, uint8_t edge)
          {
             iprintf("R");
 
+            metrics_Count(MID_DecodeBadPulse);
             ir_ResetPacket();
          }
       }
@@ -347,6 +417,7 @@ static void RC5_modifyLastBit(tRC5_lastBitType bit)
       }
       else 
       {
+         metrics_Count(MID_DecodeBadBit);
          ir_ResetPacket();
       }
    }
@@ -370,6 +441,7 @@ static void RC5_WriteBit(uint8_t bitVal)
    }
    else
    {
+      metrics_Count(MID_DecodeBadBit);
       ir_ResetPacket();
       return;
    } 
@@ -387,19 +459,83 @@ static void RC5_WriteBit(uint8_t bitVal)
    } 
    else
    {
+      /* Latch the frame and get ready for the next one */
+      RC5RxData = RC5TmpPacket.data;
+      RC5RxArrivalUS = RC5TmpPacket.startUS;
+      RC5RxHalfBitQ4 = 0;
+      if (RC5TmpPacket.spanHalfBits)
+      {
+         RC5RxHalfBitQ4 = RC5_TicksToUS((uint32_t)RC5TmpPacket.spanTicks << 4) / RC5TmpPacket.spanHalfBits;
+      }
       RC5FrameReceived = true;
+      metrics_Count(MID_FramesRx);
+      events_Post(EV_IRFrame);
+
+      ir_ResetPacket();
+   }
+}
+
+/**
+ * @brief  Track how long the frame has been running, in time and half bits.
+ *         The receiver stretches marks and shrinks spaces (or the other way
+ *         around), so only the span between edges of the same direction as the
+ *         first one tells us the sender's real bit clock.
+ * @param  rawPulseLength: time since the previous edge
+ * @param  pulse: RC5_1T_TIME or RC5_2T_TIME
+ * @param  edge: '1' for Rising  or '0' for falling edge
+ * @retval None
+ */
+static void RC5_MeasurePulse(uint16_t rawPulseLength, uint8_t pulse, uint8_t edge)
+{
+   RC5TmpPacket.runTicks += rawPulseLength;
+   RC5TmpPacket.runHalfBits += (pulse == RC5_1T_TIME) ? 1 : 2;
+
+   if (edge == 0)
+   {
+      RC5TmpPacket.spanTicks = RC5TmpPacket.runTicks;
+      RC5TmpPacket.spanHalfBits = RC5TmpPacket.runHalfBits;
    }
 }
 
+/**
+ * @brief  Convert TIM3 counts to microseconds.
+ * @param  ticks: counter value
+ * @retval Elapsed microseconds
+ */
+static uint32_t RC5_TicksToUS(uint32_t ticks)
+{
+   /* TIM_GetPrescaler() aims for TIM_COUNTER_HZ, but don't bank on it dividing evenly */
+   return (ticks * 1000) / TIMCLKValueKHz;
+}
+
 /**
  * @brief  Identify TIM clock
  * @param  None
  * @retval Timer clock
  */
 static uint32_t TIM_GetCounterCLKValue(void)
+{
+   return (TIM_GetInputCLKValue()/(TIM_GetPrescaler() + 1));
+}
+
+/**
+ * @brief  TIM3's prescaler for TIM_COUNTER_HZ at the current PCLK
+ * @param  None
+ * @retval Prescaler
+ */
+static uint32_t TIM_GetPrescaler(void)
+{
+   return ((TIM_GetInputCLKValue()/TIM_COUNTER_HZ) - 1);
+}
+
+/**
+ * @brief  Identify the clock into TIM3, before its prescaler
+ * @param  None
+ * @retval Timer input clock
+ */
+static uint32_t TIM_GetInputCLKValue(void)
 {
    uint32_t apbprescaler = 0, apbfrequency = 0;
-   uint32_t timprescaler = 0;
    uint32_t pfLatency;
    RCC_ClkInitTypeDef  RCC_ClkInitStruct;
 
@@ -411,16 +547,15 @@ static uint32_t TIM_GetCounterCLKValue(void)
    /* Get the clock prescaler of APB1 */
    apbprescaler = ((RCC->CFGR >> 8) & 0x7);
    apbfrequency = HAL_RCC_GetPCLK1Freq();
-   timprescaler = TIM_PRESCALER;
 
    /* If APBx clock div >= 4 */
    if (apbprescaler >= 4)
    {
-      return ((apbfrequency * 2)/(timprescaler + 1));
+      return (apbfrequency * 2);
    }
    else
    {
-      return (apbfrequency/(timprescaler+ 1));
+      return apbfrequency;
    }
 }
 
@@ -2,7 +2,8 @@
  */
 #include "ir_encode.h"
 #include "platform_hw.h"
-#include "iprintf.h"
+#include "log.h"
+#include "events.h"
 
 #include "stm32f0xx.h"
 #include "stm32f0xx_it.h"
@@ -14,8 +15,10 @@
 #define  RC5HIGHSTATE     ((uint8_t )0x02)   /* RC5 high level definition*/
 #define  RC5LOWSTATE      ((uint8_t )0x01)   /* RC5 low level definition*/
 
+#define  IR_CARRIER_HZ    (36000)            /* TIM17 carrier, rounded down */
+#define  IR_CARRIER_DUTY  (4)                /* 1/4 of it on */
+
 static uint8_t RC5_RealFrameLength = 14;
-static uint8_t RC5_GlobalFrameLength = 64;
 static uint16_t RC5_FrameBinaryFormat = 0;
 static uint32_t RC5_FrameManchestarFormat = 0;
 static uint8_t Send_Operation_Ready = 0;
@@ -31,6 +34,8 @@ static uint16_t RC5_BinFrameGeneration(uint8_t RC5_Address, uint8_t RC5_Instruct
 static uint32_t RC5_ManchesterConvert(uint16_t RC5_BinaryFrameFormat);
 static void TIM17_Init(void);
 static void TIM16_Init(void);
+static uint32_t TIM16_Period(void);
+static uint32_t TIM17_Period(void);
 
 void ir_InitEncode(void)
 {
@@ -55,7 +60,6 @@ void ir_SendRC5(uint8_t RC5_Address, uint8_t RC5_Instruction, RC5_Ctrl_TypeDef R
  */
 void ir_SendRaw(uint16_t message)
 {
-   HAL_StatusTypeDef res;
    uint16_t frameBinaryFormat = 0;
 
    // make sure there is a start bit set
@@ -66,12 +70,11 @@ void ir_SendRaw(uint16_t message)
 
    /* Set the Send operation Ready flag to indicate that the frame is ready to be sent */
    Send_Operation_Ready = 1;
+   /* We're sending as of now, not as of the first bit clock ISR */
+   Send_Operation_Completed = false;
 
    //start the bit clock. Each edge it will send data on its own
-   res = HAL_TIM_Base_Start_IT(&htim16);
-   if(res != HAL_OK) {
-      iprintf("Failed to start TIM16 CH1 to send\r\n");
-   }
+   platformHW_TimStartIT(&htim16);
 }
 
 /**
@@ -83,7 +86,9 @@ void ir_SignalGenerate(void)
 {
    uint8_t bit_msg = 0;
 
-   if((Send_Operation_Ready == 1) && (BitsSent_Counter <= (RC5_GlobalFrameLength * 2)))
+   /* Stop after the last half bit (plus one to turn the carrier off) instead
+      of idling out the rest of the standard RC5 repeat period */
+   if((Send_Operation_Ready == 1) && (BitsSent_Counter <= (RC5_RealFrameLength * 2)))
    {
       Send_Operation_Completed = false;
       bit_msg = (uint8_t)((RC5_FrameManchestarFormat >> BitsSent_Counter)& 1);
@@ -91,7 +96,7 @@ void ir_SignalGenerate(void)
       if (bit_msg== 1)
       {
          //enable the data out clock
-         HAL_TIM_PWM_Start(&htim17, TIM_CHANNEL_1);
+         platformHW_TimPWMStart(&htim17);
 
          /*
          //FIXME rm, play out a GPIO for testing
@@ -108,7 +113,7 @@ void ir_SignalGenerate(void)
       else
       {
          //FIXME rm, play out a GPIO for testing
-         HAL_TIM_PWM_Stop(&htim17, TIM_CHANNEL_1);
+         platformHW_TimPWMStop(&htim17);
 
          /*
          //FIXME rm
@@ -125,18 +130,14 @@ void ir_SignalGenerate(void)
       BitsSent_Counter++;
 
       //restart timer to count to next bit edge
-      HAL_TIM_Base_Start_IT(&htim16);
+      platformHW_TimStartIT(&htim16);
    }
    else
    {
       Send_Operation_Completed = true;
+      events_Post(EV_IRTxDone);
 
-      HAL_StatusTypeDef res;
-
-      res = HAL_TIM_Base_Stop_IT(&htim16);
-      if(res != HAL_OK) {
-         iprintf("Failed to stop TIM16 after sending message\r\n");
-      }
+      platformHW_TimStopIT(&htim16);
 
       //force TIM17's output low so it never accidentally idles high after sending
       HAL_GPIO_WritePin(GPIOA, GPIO_PIN_7, GPIO_PIN_RESET);
@@ -216,6 +217,28 @@ bool ir_IsSending(void) {
    return (Send_Operation_Completed == false);
 }
 
+/**
+ * Set TIM16 and TIM17 up again for the new PCLK. Never while sending.
+ */
+void ir_EncodeClockChanged(void)
+{
+   TIM17_Init();
+   TIM16_Init();
+}
+
+/* TIM16 period for a half bit at the current PCLK */
+static uint32_t TIM16_Period(void)
+{
+   return ((((IR_HALF_BIT_PERIOD + 1) * (HAL_RCC_GetPCLK1Freq() / 1000)) + (IR_HALF_BIT_PERIOD_KHZ / 2)) /
+         IR_HALF_BIT_PERIOD_KHZ) - 1;
+}
+
+/* TIM17 period for the carrier at the current PCLK */
+static uint32_t TIM17_Period(void)
+{
+   return ((HAL_RCC_GetPCLK1Freq() + IR_CARRIER_HZ - 1) / IR_CARRIER_HZ) - 1;
+}
+
 /* TIM16 init function */
 static void TIM16_Init(void)
 {
@@ -225,24 +248,24 @@ static void TIM16_Init(void)
    htim16.Instance = TIM16;
    htim16.Init.Prescaler = 0;
    htim16.Init.CounterMode = TIM_COUNTERMODE_UP;
-   htim16.Init.Period = 42627;
+   htim16.Init.Period = TIM16_Period();
    htim16.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
    htim16.Init.RepetitionCounter = 0;
    htim16.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
    if (HAL_TIM_Base_Init(&htim16) != HAL_OK)
    {
-      iprintf("Error\r\n");
+      LOG_ERROR("Error\r\n");
       return;
    }
 
    if (HAL_TIM_PWM_Init(&htim16) != HAL_OK)
    {
-      iprintf("Error\r\n");
+      LOG_ERROR("Error\r\n");
       return;
    }
 
    sConfigOC.OCMode = TIM_OCMODE_PWM1;
-   sConfigOC.Pulse = 42627;
+   sConfigOC.Pulse = htim16.Init.Period;
    sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
    sConfigOC.OCNPolarity = TIM_OCNPOLARITY_HIGH;
    sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
@@ -250,7 +273,7 @@ static void TIM16_Init(void)
    sConfigOC.OCNIdleState = TIM_OCNIDLESTATE_RESET;
    if (HAL_TIM_PWM_ConfigChannel(&htim16, &sConfigOC, TIM_CHANNEL_1) != HAL_OK)
    {
-      iprintf("Error\r\n");
+      LOG_ERROR("Error\r\n");
       return;
    }
 
@@ -263,7 +286,7 @@ static void TIM16_Init(void)
    sBreakDeadTimeConfig.AutomaticOutput = TIM_AUTOMATICOUTPUT_ENABLE;
    if (HAL_TIMEx_ConfigBreakDeadTime(&htim16, &sBreakDeadTimeConfig) != HAL_OK)
    {
-      iprintf("Error\r\n");
+      LOG_ERROR("Error\r\n");
       return;
    }
 }
@@ -277,24 +300,24 @@ static void TIM17_Init(void)
    htim17.Instance = TIM17;
    htim17.Init.Prescaler = 0;
    htim17.Init.CounterMode = TIM_COUNTERMODE_UP;
-   htim17.Init.Period = 1333;
+   htim17.Init.Period = TIM17_Period();
    htim17.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
    htim17.Init.RepetitionCounter = 0;
    htim17.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
    if (HAL_TIM_Base_Init(&htim17) != HAL_OK)
    {
-      iprintf("Error\r\n");
+      LOG_ERROR("Error\r\n");
       return;
    }
 
    if (HAL_TIM_PWM_Init(&htim17) != HAL_OK)
    {
-      iprintf("Error\r\n");
+      LOG_ERROR("Error\r\n");
       return;
    }
 
    sConfigOC.OCMode = TIM_OCMODE_PWM1;
-   sConfigOC.Pulse = 333;
+   sConfigOC.Pulse = (htim17.Init.Period + 1) / IR_CARRIER_DUTY;
    sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
    sConfigOC.OCNPolarity = TIM_OCNPOLARITY_HIGH;
    sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
@@ -302,7 +325,7 @@ static void TIM17_Init(void)
    sConfigOC.OCNIdleState = TIM_OCNIDLESTATE_RESET;
    if (HAL_TIM_PWM_ConfigChannel(&htim17, &sConfigOC, TIM_CHANNEL_1) != HAL_OK)
    {
-      iprintf("Error\r\n");
+      LOG_ERROR("Error\r\n");
       return;
    }
 
@@ -315,7 +338,7 @@ static void TIM17_Init(void)
    sBreakDeadTimeConfig.AutomaticOutput = TIM_AUTOMATICOUTPUT_DISABLE;
    if (HAL_TIMEx_ConfigBreakDeadTime(&htim17, &sBreakDeadTimeConfig) != HAL_OK)
    {
-      iprintf("Error\r\n");
+      LOG_ERROR("Error\r\n");
       return;
    }
 }
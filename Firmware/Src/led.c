@@ -4,7 +4,10 @@
 #include "led.h"
 #include "platform_hw.h"
 #include "color.h"
-#include "iprintf.h"
+#include "log.h"
+#include "metrics.h"
+#include "timing.h"
+#include "rng.h"
 #include "stm32f0xx_hal.h"
 #include "stm32f0xx_hal_gpio.h"
 #include "stm32f0xx_hal_spi.h"
@@ -13,17 +16,24 @@
 #include "yabi/yabi.h"
 
 #include <string.h>
-#include <stdlib.h>
 
 #define YABI_CHANNELS      (LED_CHAIN_LENGTH * 3)
+// The shortest transition, for led_ShowNow()
+#define SHOW_NOW_MS        ( 1 )
 
 #define PUMP_INTERVAL_MS   ( 33 )
+// Slow fades with nobody around to see them, and more time in stop mode
+#define SLOW_PUMP_INTERVAL_MS ( 100 )
 
 static uint8_t const DefaultTransitionTimeMS = 100;
 struct led_State {
    SPI_HandleTypeDef             spi;
 
-   //this is crappy. We store BOTH the HSV state (for math) and the RGB state
+   //the colors as they are now, what frames go out from. YABI's records below
+   //hold the same values (each channel's current one), but in YABI's own layout
+   //and only through its callbacks, so this is a second copy: 3 bytes an LED.
+   //There's no RGB copy, they become RGB on their way out
+   //(platformHW_UpdateLEDs())
    struct color_ColorHSV         ledsHSV[LED_CHAIN_LENGTH];
 
    //the data which backs YABI's channels. Arranged in groups of 3. The grouping
@@ -31,13 +41,15 @@ struct led_State {
    //math is used to figure out which is which at channel-set time.
    struct yabi_ChannelRecord     yabiBacking[YABI_CHANNELS];
 
-   //the last time the animation stack was pumped
+   //the last time the animation stack was pumped, and how often it is
    uint32_t                      lastPump;
+   uint32_t                      pumpInterval;
+   //what pumpInterval is made of: slow frames or not, stretched to save power
+   bool                          slowFrames;
+   uint8_t                       frameStretch;
 };
 static struct led_State state;
 
-extern union platformHW_LEDRegister  LedRegisterStates[LED_CHAIN_LENGTH];
-
 static baf_ChannelID animationChannelIDs[LED_CHAIN_LENGTH] = {0};
 // This is the 'animation' that the system runs
 static struct baf_Animation AnimRGBFade = {
@@ -105,10 +117,14 @@ bool led_Init(void) {
       .numChannels = YABI_CHANNELS,
    };
 
+   state.slowFrames = false;
+   state.frameStretch = 1;
+   state.pumpInterval = PUMP_INTERVAL_MS;
+
    // setup the channel interpolator
    yres = yabi_init(&yc, &csc);
    if(yres != YABI_OK) {
-      iprintf("YABI init returned %d\n", yres);
+      LOG_ERROR("YABI init returned %d\n", yres);
       return false;
    }
 
@@ -122,8 +138,6 @@ bool led_Init(void) {
    for(int i = 0; i < YABI_CHANNELS; i++) {
       //wire up BAF so it's channels are YABI's Hue's
       if(i % 3 == 0) {
-         iprintf("Setting BAF channel ID %d to YABI %d\r\n", i/3, i);
-
          animationChannelIDs[i/3] = i;
 
          //FIXME rm?
@@ -135,7 +149,7 @@ bool led_Init(void) {
    // setup the animation framework
    bres = baf_init(&bc);
    if(bres != BAF_OK) {
-      iprintf("BAF init returned %d\n", bres);
+      LOG_ERROR("BAF init returned %d\n", bres);
       return false;
    }
    return true;
@@ -152,7 +166,7 @@ bool led_StartAnimation(void) {
 
 void led_SetBiasWeight(uint8_t biasWeight) {
    if(biasWeight > 100) {
-      iprintf("Nonsense bias weight %d is larger than 100\n", biasWeight);
+      LOG_WARN("Nonsense bias weight %d is larger than 100\n", biasWeight);
       return;
    }
 
@@ -228,8 +242,29 @@ bool led_SetChannel(uint32_t id, struct color_ColorHSV c) {
    return true;
 }
 
+/*
+ * Straight to these colors (LED_CHAIN_LENGTH of them) and out in a frame now,
+ * rather than a fade there over the next few frames. YABI only moves in
+ * transitions, so it gets the shortest one and is pumped once that's over.
+ * The frame goes out either way, false if any channel didn't take its color.
+ */
+bool led_ShowNow(struct color_ColorHSV const * const colors) {
+   yabi_Error res = YABI_OK;
+
+   for(uint32_t i = 0; i < LED_CHAIN_LENGTH; i++) {
+      res |= yabi_setChannel((i * 3) + 0, colors[i].h, SHOW_NOW_MS);
+      res |= yabi_setChannel((i * 3) + 1, colors[i].s, SHOW_NOW_MS);
+      res |= yabi_setChannel((i * 3) + 2, colors[i].v, SHOW_NOW_MS);
+   }
+   HAL_Delay(SHOW_NOW_MS);
+
+   state.lastPump = HAL_GetTick();
+   yabi_giveTime(state.lastPump);
+   return res == YABI_OK;
+}
+
 static uint32_t bafRNGCB(uint32_t range) {
-   return rand() % range;
+   return rng_Below(range);
 }
 
 // shim to connect BAF's channel group setting API to YABI's one-at-a-time API
@@ -240,17 +275,17 @@ static void bafChanGroupSetCB(struct baf_ChannelSetting const * const channels,
 
       if(YABI_OK != yabi_setChannel(channels[i].id, values[i], channels[i].transitionTimeMS)) {
          //TODO handle?
-         iprintf("Failed to set yabi channel value!\n");
+         LOG_ERROR("Failed to set yabi channel value!\n");
       }
    }
 }
 
 static void bafAnimStartCB(struct baf_Animation const * anim) {
-   iprintf("Animation #%u Start\n", anim->id);
+   LOG_DEBUG("Animation #%d Start\n", (int)anim->id);
    //TODO wire?
 }
 static void bafAnimStopCB(struct baf_Animation const * anim) {
-   iprintf("Animation #%u Stop\n", anim->id);
+   LOG_DEBUG("Animation #%d Stop\n", (int)anim->id);
    //TODO wire?
 }
 
@@ -261,7 +296,7 @@ static void* const led_HwInit(void) {
    }
 
    //wipe out our state struct
-   memset(state.ledsHSV, 0, sizeof(state.ledsHSV) / sizeof(state.ledsHSV[0]));
+   memset(state.ledsHSV, 0, sizeof(state.ledsHSV));
    //TODO anything else to clear?
 
    return NULL;
@@ -270,7 +305,7 @@ static void* const led_HwInit(void) {
 /*
  * This is the hook Yabi calls to set a channel. Yabi doesn't know about HSV, so
  * it uses a mapping scheme to control each parameter. This function is called by
- * Yabi, applies the mapping, then applies the change to the LEDs.
+ * Yabi, applies the mapping, then stores the change for the next frame out.
  * The mapping is the obvious one:
  * 0 - H
  * 1 - S
@@ -298,9 +333,6 @@ static void led_YabiSetChannelCB(yabi_ChanID chan, yabi_ChanValue value) {
       default:
          break;
    }
-
-   //now apply the HSV array directly to the RGB array (in platform_hw)
-   color_HSV2RGB(hsv, &LedRegisterStates[realChan].color);
 }
 
 /*
@@ -308,12 +340,21 @@ static void led_YabiSetChannelCB(yabi_ChanID chan, yabi_ChanValue value) {
  */
 static void led_UpdateChannels(yabi_FrameID frame) {
    (void)frame;
-   platformHW_UpdateLEDs(&state.spi);
+   platformHW_UpdateLEDs(&state.spi, state.ledsHSV);
+   metrics_Count(MID_LEDFrames);
 }
 
 void led_GiveTime(uint32_t systimeMS) {
    //FIXME need to slow down YABI so its forced 1 unit movement doesn't make things too fast
-   if(systimeMS - state.lastPump > PUMP_INTERVAL_MS) {
+   if(systimeMS - state.lastPump > state.pumpInterval) {
+      // Only the frames, the calls with nothing to do would drown them out
+      TIMING_SCOPE(TS_LEDGiveTime);
+
+      // Late enough that whole frames went by without us
+      if(state.lastPump != 0 && systimeMS - state.lastPump > 2 * state.pumpInterval) {
+         metrics_CountN(MID_LEDFramesSkipped, (systimeMS - state.lastPump) / state.pumpInterval - 1);
+      }
+
       //FYI: the NULL is time until next call. Not useful without threads
       baf_giveTime(systimeMS, NULL);
       yabi_giveTime(systimeMS);
@@ -322,3 +363,28 @@ void led_GiveTime(uint32_t systimeMS) {
    }
 }
 
+/*
+ * How long until led_GiveTime() has a frame to pump, in ms.
+ */
+uint32_t led_TimeToNextFrame(uint32_t systimeMS) {
+   uint32_t const elapsedMS = systimeMS - state.lastPump;
+
+   return (elapsedMS > state.pumpInterval) ? 0 : state.pumpInterval + 1 - elapsedMS;
+}
+
+/*
+ * Fewer frames a second, for when the fades are slow anyway.
+ */
+void led_SetSlowFrames(bool slow) {
+   state.slowFrames = slow;
+   state.pumpInterval = (slow ? SLOW_PUMP_INTERVAL_MS : PUMP_INTERVAL_MS) * state.frameStretch;
+}
+
+/*
+ * Even fewer frames, this many times further apart, to save power.
+ */
+void led_SetFrameStretch(uint8_t stretch) {
+   state.frameStretch = (stretch > 1) ? stretch : 1;
+   led_SetSlowFrames(state.slowFrames);
+}
+
@@ -0,0 +1,42 @@
+/*
+ * The tokenized half of log.h. Text logging is just iprintf().
+ */
+#include "log.h"
+#include "iprintf.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+
+#ifdef LOG_TOKENIZED
+
+/*
+ * One record, little endian:
+ *    LOG_TOKEN_MARKER, token (2 bytes), argument count, arguments (4 bytes each)
+ * %s arguments go as the pointer, which log_decode can only follow into flash.
+ * Sent whole or not at all, so a full buffer never leaves half a record.
+ */
+void log_Tokenized(uint16_t token, uint8_t numArgs, ...) {
+   uint8_t record[4 + (LOG_MAX_ARGS * 4)];
+   uint8_t *p = record;
+   va_list args;
+
+   *p++ = LOG_TOKEN_MARKER;
+   *p++ = token & 0xFF;
+   *p++ = token >> 8;
+   *p++ = numArgs;
+
+   va_start(args, numArgs);
+   for(int i = 0; i < numArgs; i++) {
+      uint32_t const arg = va_arg(args, uint32_t);
+
+      *p++ = arg & 0xFF;
+      *p++ = (arg >> 8) & 0xFF;
+      *p++ = (arg >> 16) & 0xFF;
+      *p++ = arg >> 24;
+   }
+   va_end(args);
+
+   iprintf_Write(record, p - record);
+}
+
+#endif
@@ -4,41 +4,65 @@
 #include "stm32f0xx_hal.h"
 #include "stm32f0xx_hal_gpio.h"
 #include "stm32f0xx_hal_tim.h"
-#include "iprintf.h"
+#include "log.h"
 
 #include "led.h"
 #include "board_id.h"
+#include "rng.h"
 #include "version.h"
 
-#include "baf/baf.h"
-#include "yabi/yabi.h"
-
 #include "pattern.h"
+#include "ir_encode.h"
+#include "ir_decode.h"
+#include "metrics.h"
+#include "timing.h"
+#include "profile.h"
+#include "ir_capture.h"
+#include "events.h"
+#include "power.h"
+#include "boot.h"
 
 #include <string.h>
-#include <stdlib.h>
 
 static void VersionToLEDs(void);
+static void HandleRequest(void);
+static void SetClock(bool fast);
+static void BootReport(void);
 
 int main(void)
 {
    // Reset of all peripherals, Initializes the Flash interface and the Systick
    HAL_Init();
+   boot_Mark(BS_HAL);
 
+   // Paints the stack for metrics, so before anything gets deep
    platformHW_Init();
+   metrics_Init();
+   timing_Init();
+   boot_Mark(BS_Platform);
 
-   iprintf("\r\nStarting... (v%d | #0x%x | Built "__DATE__":"__TIME__")\r\n", FW_VERSION, bid_GetID());
-
-   // seed the PRNG from the kinda unique board ID
-   srand(bid_GetID());
-
-   // setup the entire LED framework (w/ animation)
+   // setup the entire LED framework (w/ animation). Color first, the rest
+   // after, and nothing logged until it's all up
    led_Init();
+   boot_Mark(BS_LED);
 
    // Display the FW version on the LEDs
    VersionToLEDs();
+   boot_Mark(BS_FirstFrame);
+
+   // seed the PRNG from all of the board ID, and some ADC noise so it's not
+   // the same every boot. Before the pattern starts the animation off it.
+   rng_Seed(bid_GetHash() ^ platformHW_Noise());
+   boot_Mark(BS_Seed);
 
    pattern_Init();
+   boot_Mark(BS_Pattern);
+   power_Init();
+   boot_Mark(BS_Power);
+   events_Init();
+   boot_Mark(BS_Ready);
+
+   BootReport();
 
    // FIXME rm?
    /*
@@ -68,39 +92,126 @@ int main(void)
          led_SetChannel(1, COLOR_HSV_BLACK);
       }
       */
-      pattern_GiveTime(HAL_GetTick());
-      led_GiveTime(HAL_GetTick());
+      uint32_t const loopStart = platformHW_GetMicros();
+      uint32_t const events = events_Take();
+      struct pattern_Status status;
+
+      // Whatever the IR or the button did, the pattern sorts out
+      if((events & (EV_IRFrame | EV_IRTxDone | EV_Button)) || events_Due(ED_Pattern, loopStart)) {
+         pattern_GiveTime(loopStart);
+      }
+      if(events_Due(ED_LEDFrame, loopStart)) {
+         led_GiveTime(HAL_GetTick());
+      }
+      if(events & EV_Request) {
+         HandleRequest();
+      }
+      power_GiveTime(loopStart);
+
+      // Stop mode only with nobody around, when missing the start of a burst
+      // costs least, and never with IR going out
+      pattern_GetStatus(&status);
+      events_AllowStop(status.neighbors == 0 && !ir_IsSending());
+      // and 48MHz only for IR bursts, in or out. Fades, and the wait for the
+      // next beacon, get by on 8. The first frame of a burst coming in does too.
+      SetClock(status.sending || status.receiving);
+
+      events_SetDeadline(ED_Pattern, loopStart, pattern_TimeToNextEvent(loopStart));
+      events_SetDeadline(ED_LEDFrame, loopStart, led_TimeToNextFrame(HAL_GetTick()) * 1000);
+      metrics_GiveTime(platformHW_GetMicros() - loopStart);
+
+      // Nothing to do until the next frame or beacon, or an interrupt says so
+      events_Wait();
    }
 }
 
 /*
- * Write this unit's SW version to the LEDs once.
+ * Single character requests over USART1, for diagnostics. The reports are
+ * longer than the log buffer, so the main loop waits while they go out (a few
+ * tens of ms), which is fine for something asked for by hand.
+ */
+static void HandleRequest(void) {
+   uint8_t ch;
+
+   if(!iprintf_GetChar(&ch)) {
+      return;
+   }
+
+   iprintf_Blocking(true);
+   switch(ch) {
+      case 'm':
+         metrics_Report();
+         break;
+
+      case 'p':
+         profile_Report();
+         break;
+
+      case 'c':
+         ir_CaptureReport();
+         break;
+
+      case 'b':
+         boot_Report();
+         break;
+
+      default:
+         break;
+   }
+   iprintf_Blocking(false);
+}
+
+/*
+ * Change clocks, taking the IR timers along. Not with a frame going out or
+ * coming in, and platformHW_SetClock() won't with the UART busy, so it may
+ * take a few goes.
+ */
+static void SetClock(bool fast) {
+   if(fast == platformHW_IsClockFast() || ir_IsSending() || ir_IsReceiving()) {
+      return;
+   }
+   if(platformHW_SetClock(fast)) {
+      ir_EncodeClockChanged();
+      ir_DecodeClockChanged();
+   }
+}
+
+/*
+ * Write this unit's SW version to the LEDs, up at once: it's the first thing
+ * anyone sees after power on, and the pattern fades on from it.
  */
 static void VersionToLEDs(void) {
-   struct color_ColorHSV c = {.h = 0, .s = 255, .v = 0};
+   struct color_ColorHSV c[LED_CHAIN_LENGTH];
 
-   //unpack each bit, and set the Blue LED channel to it
+   //unpack each bit, blue if it's set, green otherwise
    uint16_t mask = 0x01;
    for(int i = 0; i < LED_CHAIN_LENGTH; i++) {
-      // set the channel to 100 counts if the bit is set, 0 otherwise
-      c.h = (mask & FW_VERSION) ? HSV_COLOR_B : HSV_COLOR_G;
-      c.s = 255;
-      c.v = 255;
-
-      led_SetChannel(i, c);
+      c[i].h = (mask & FW_VERSION) ? HSV_COLOR_B : HSV_COLOR_G;
+      c[i].s = 255;
+      c[i].v = 255;
 
       mask <<= 1;
    }
 
-   // Fade in over 1.5 seconds
-   for(int i = 0; i < 150; i++) {
-      // This looks better without the LED module's clock division
-      baf_giveTime(i, NULL);
-      yabi_giveTime(i);
-      HAL_Delay(10);  //delay in MS
+   if(!led_ShowNow(c)) {
+      LOG_ERROR("Failed to show the version!\r\n");
    }
 }
 
+/*
+ * What boot would have logged on the way, now the badge is lit and running.
+ * Waits for room like HandleRequest(), which holds up the first pass of the
+ * main loop by a few tens of ms.
+ */
+static void BootReport(void) {
+   iprintf_Blocking(true);
+   LOG_INFO("\r\nStarting... (v%d | #0x%x | Built "__DATE__":"__TIME__")\r\n", FW_VERSION, (unsigned)bid_GetID());
+   bid_Report();
+   ir_DecodeReport();
+   boot_Report();
+   iprintf_Blocking(false);
+}
+
 #ifdef USE_FULL_ASSERT
 
 /**
@@ -0,0 +1,98 @@
+/*
+ * See metrics.h. The dump goes out through iprintf() whatever the log level, so
+ * it's there in release builds too.
+ */
+#include "metrics.h"
+#include "platform_hw.h"
+#include "iprintf.h"
+#include "timing.h"
+#include "stm32f0xx_hal.h"
+
+#include <stdint.h>
+
+static struct metrics_State {
+   uint32_t values[MID_Count];
+} state;
+
+static char const * const Names[MID_Count] = {
+   [MID_UptimeMS]          = "up",
+   [MID_BeaconsTx]         = "btx",
+   [MID_BeaconsRx]         = "brx",
+   [MID_FramesRx]          = "frx",
+   [MID_FramesRejected]    = "frej",
+   [MID_DecodeBadPulse]    = "dpulse",
+   [MID_DecodeBadBit]      = "dbit",
+   [MID_DecodeTimeout]     = "dtimeout",
+   [MID_LEDFrames]         = "led",
+   [MID_LEDFramesSkipped]  = "ledskip",
+   [MID_LEDFramesLimited]  = "ledlim",
+   [MID_LEDmA]             = "ledma",
+   [MID_LEDmAh]            = "ledmah",
+   [MID_LoopMaxUS]         = "loopmax",
+   [MID_SleepMS]           = "sleep",
+   [MID_Stops]             = "stops",
+   [MID_WakeMaxUS]         = "wakemax",
+   [MID_ClockSwitches]     = "clocksw",
+   [MID_VddMV]             = "vdd",
+   [MID_PowerLevel]        = "plevel",
+   [MID_BatteryUA]         = "batua",
+   [MID_RuntimeMin]        = "runtime",
+   [MID_ISRSysTick]        = "isrtick",
+   [MID_ISRButton]         = "isrbutton",
+   [MID_ISRIRRx]           = "isrirrx",
+   [MID_ISRIRTx]           = "isrirtx",
+   [MID_ISRUart]           = "isruart",
+   [MID_RampPosition]      = "ramp",
+   [MID_StackFree]         = "stackfree",
+   [MID_StaticRAM]         = "ramstatic",
+   [MID_LogDropped]        = "logdrop",
+};
+
+void metrics_Init(void) {
+   for(int i = 0; i < MID_Count; i++) {
+      state.values[i] = 0;
+   }
+}
+
+/*
+ * Once per main loop, with how long the last loop took.
+ */
+void metrics_GiveTime(uint32_t loopUS) {
+   if(loopUS > state.values[MID_LoopMaxUS]) {
+      state.values[MID_LoopMaxUS] = loopUS;
+   }
+}
+
+void metrics_Count(enum metrics_ID id) {
+   state.values[id]++;
+}
+
+void metrics_CountN(enum metrics_ID id, uint32_t n) {
+   state.values[id] += n;
+}
+
+void metrics_Set(enum metrics_ID id, uint32_t value) {
+   state.values[id] = value;
+}
+
+uint32_t metrics_Get(enum metrics_ID id) {
+   return state.values[id];
+}
+
+/*
+ * One line, longer than the log buffer, so send it with iprintf_Blocking() on.
+ */
+void metrics_Report(void) {
+   state.values[MID_UptimeMS] = HAL_GetTick();
+   state.values[MID_StackFree] = platformHW_StackFree();
+   state.values[MID_StaticRAM] = platformHW_StaticRAM();
+   state.values[MID_LogDropped] = iprintf_GetDropped();
+
+   iprintf("METRICS");
+   for(int i = 0; i < MID_Count; i++) {
+      iprintf(" %s=%d", Names[i], (int)state.values[i]);
+   }
+   iprintf("\r\n");
+
+   timing_Report();
+}
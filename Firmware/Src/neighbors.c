@@ -0,0 +1,75 @@
+#include "neighbors.h"
+#include "beacons.h"
+#include "log.h"
+
+#include "stm32f0xx_hal.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// Nobody goes longer than BEACON_MAX_GAP_MS between beacons, so this is two
+// missed beacons
+#define NEIGHBOR_TIMEOUT_MS      ((2 * BEACON_MAX_GAP_MS) + 5000)
+#define NEIGHBOR_EMPTY           (0xFF)
+
+// Parallel arrays, to not pay for padding
+struct nbr_State {
+   uint8_t     id[NEIGHBOR_TABLE_LEN];
+   uint32_t    lastSeen[NEIGHBOR_TABLE_LEN];
+};
+static struct nbr_State state;
+
+void nbr_Init(void) {
+   memset(&state, 0, sizeof(state));
+   memset(state.id, NEIGHBOR_EMPTY, sizeof(state.id));
+}
+
+/*
+ * Note that we heard from a badge, adding it if it's new.
+ */
+void nbr_Saw(uint8_t id) {
+   uint32_t const now = HAL_GetTick();
+   int i, slot = 0;
+
+   for(i = 0; i < NEIGHBOR_TABLE_LEN; i++) {
+      if(state.id[i] == id) {
+         state.lastSeen[i] = now;
+         return;
+      }
+
+      // Keep track of where it would go. An empty slot, or failing that whoever
+      // we heard from longest ago.
+      if(state.id[slot] != NEIGHBOR_EMPTY &&
+            (state.id[i] == NEIGHBOR_EMPTY || now - state.lastSeen[i] > now - state.lastSeen[slot])) {
+         slot = i;
+      }
+   }
+
+   if(state.id[slot] != NEIGHBOR_EMPTY) {
+      LOG_DEBUG("Neighbor %d evicted by %d\r\n", state.id[slot], id);
+   }
+   state.id[slot] = id;
+   state.lastSeen[slot] = now;
+}
+
+/*
+ * How many distinct badges we've heard from recently. Ages out stale ones.
+ */
+uint8_t nbr_Count(void) {
+   uint32_t const now = HAL_GetTick();
+   uint8_t count = 0;
+   int i;
+
+   for(i = 0; i < NEIGHBOR_TABLE_LEN; i++) {
+      if(state.id[i] == NEIGHBOR_EMPTY) {
+         continue;
+      }
+
+      if(now - state.lastSeen[i] > NEIGHBOR_TIMEOUT_MS) {
+         state.id[i] = NEIGHBOR_EMPTY;
+         continue;
+      }
+      count++;
+   }
+   return count;
+}
@@ -4,6 +4,12 @@ when 3/part, dragonflies do a random slow fade across all LEDS
 when two or more people are together, their badges obviously synchronize colors but are still somewhat random and slow
 when 3/4+ people are together, their badges animations speed up and are nearly the same color
 
+"People" are counted as distinct badges heard from recently (see neighbors.c),
+so one chatty badge doesn't look like a crowd.
+
+Pressing the button changes the crowd's mode (see gossip.c), e.g. everyone goes
+blue. It spreads from badge to badge and the newest change wins.
+
 See https://workflowy.com/s/E7Zu.sFDTbsFAk9
 
 References:
@@ -14,29 +20,77 @@ The way real fireflies do it: ncase.me/fireflies/
 #include "beacons.h"
 #include "color.h"
 #include "led.h"
-
-#include "iprintf.h"
+#include "neighbors.h"
+#include "clock_trim.h"
+#include "gossip.h"
+#include "metrics.h"
+#include "timing.h"
+#include "rng.h"
+
+#include "log.h"
+#include "utilities.h"
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
 
 // Get the period of the hue clock for a given beacon interval
 #define HUE_PERIOD_MS_FOR_BEACON(x)       ((x) / 5)
 
-enum BeaconIntervalChoice {
-   BIC_Increase,
-   BIC_Decrease,
-};
-
-// Parallel arrays used to set clock intervals
+// Parallel arrays used to set clock intervals, indexed by how many neighbors
+// we can hear. Multiples of PATTERN_INTERVAL_GRID_MS.
 #define BEACON_INTERVAL_RAMP_LEN          (7)
 static const uint16_t BeaconIntervalRampMS[BEACON_INTERVAL_RAMP_LEN] =
-   {30000, 20000, 10000, 10000, 5000, 5000, 4000};
+   {30000, 20000, 10000, 10000, 5000, 5000, 5000};
 //FIXME better way to calculate this automatically, or tune it
 static const uint16_t BiasWeightRamp[BEACON_INTERVAL_RAMP_LEN] =
    {0    , 40   , 60,     70  , 80  , 90  , 100};
 
-// Amount to bump Beacon clock time when a beacon is seen
-// 10% of total value?
-#define GET_BEACON_BUMP(x)                ((x) / 10)
+// Clock periods are kept in ms, timestamps in us
+#define MS_TO_US(x)                       ((uint32_t)(x) * 1000)
+
+// Phase errors measured over one beacon interval are kept, and at the next tick
+// we move by their mean, or this shift of it. Taking half keeps a crowd of
+// badges from chasing each other around. One correction per tick however many
+// neighbors there are. Each error counts for at most PHASE_SAMPLE_MAX_US, so
+// one odd beacon (a badge just finding the crowd) can't drag us far. A median
+// throws away too much: with only a few samples a tick it wanders more than
+// the noise it's rejecting.
+#define PHASE_CORRECTION_SHIFT            (1)
+#define PHASE_SAMPLES                     (8)
+#define PHASE_SAMPLE_MAX_US               (100000)
+// Clock trim leaves rates a fraction of a percent apart, tens of ms an interval,
+// which halving the error each tick never quite catches up with. So we also
+// learn how much faster our clock runs than the crowd's (a small fraction of
+// each error, this shift of it) and stretch the grid by that. It leaks away
+// slowly so a crowd can't drift off together. At most PHASE_RATE_MAX_US a
+// second.
+#define PHASE_RATE_SHIFT                  (3)
+#define PHASE_RATE_LEAK_SHIFT             (8)
+#define PHASE_RATE_MAX_US                 (10000)
+
+// Send our whole crowd epoch along with every Nth beacon. It goes out sooner
+// when it looks like someone around hasn't heard it.
+#define EPOCH_EVERY_N_BEACONS             (4)
+
+// Eight slots don't hold a beacon a tick from everyone in a big crowd, and a
+// few a tick is plenty to correct phase by. So past this many neighbors we
+// skip ticks, keeping it to about this many an interval around us.
+#define BEACONS_PER_INTERVAL              (4)
+
+// Crowd-wide modes, spread as the gossip setting. Settings we don't know (from
+// newer firmware) act like PM_Crowd.
+enum pattern_Mode {
+   PM_Crowd,   // normal behavior
+   PM_Red,     // everyone goes red...
+   PM_Green,
+   PM_Blue,
+   PM_Count,
+};
+static const uint8_t ModeHues[PM_Count] =
+   {0, HSV_COLOR_R, HSV_COLOR_G, HSV_COLOR_B};
+
+// Ignore button bounce for this long after a press
+#define BUTTON_DEBOUNCE_US                (250000)
 
 // STATE STUFF
 // Fast hue clock. The period is = the time between ticks of the Beacon Clock.
@@ -51,7 +105,44 @@ static uint16_t BeaconClockInterval;
 static uint16_t BeaconClockRampPosition;
 static uint32_t LastBeaconClockTime;
 
-static void pattern_SetBeaconInterval(enum BeaconIntervalChoice c);
+// Phase errors heard since the last tick, and how many us a second we run
+// ahead of the crowd
+static int32_t PhaseSamples[PHASE_SAMPLES];
+static uint8_t NumPhaseSamples;
+static int32_t PhaseRateUS;
+
+// A beacon waiting for its TX slot to come around, and the gossip it carries
+static bool BeaconPending;
+static uint8_t BeaconSlot;
+static bool GossipPending;
+static uint8_t GossipVersion;
+static uint8_t GossipSetting;
+// Saving power, only every Nth tick's beacon goes out. The clock still ticks.
+static uint8_t BeaconEvery;
+static uint8_t TicksSinceBeacon;
+
+// Crowd epoch as of the last beacon clock tick, ms. Starts as our uptime, but
+// when crowds meet everyone takes on the oldest one. Each tick moves it on by
+// the interval, not by however long our own clock says it was: a crowd in
+// phase ticks together, so its epochs stay exactly the same whatever each
+// badge's clock rate. Always whole seconds.
+static uint32_t EpochTickMS;
+static uint8_t BeaconsUntilEpoch;
+
+// Set by the button ISR
+static volatile bool ButtonPressed;
+static uint32_t LastButtonTime;
+
+static void pattern_SetBeaconInterval(uint8_t rampPosition);
+static uint32_t pattern_TimeUntil(uint32_t nowUS, uint32_t lastUS, uint32_t periodUS);
+static void pattern_ShiftClocks(int32_t deltaUS);
+static void pattern_CorrectPhase(void);
+static int32_t pattern_PhaseError(uint32_t tickUS);
+static int32_t pattern_GridUS(void);
+static uint32_t pattern_EpochAt(uint32_t timeUS);
+static void pattern_SawEpoch(struct beacon_Beacon const * const beacon);
+static void pattern_ApplyMode(void);
+static enum pattern_Mode pattern_Mode(void);
 static void pattern_UpdateAnimation(uint8_t hue);
 static void pattern_UpdateSimpleHue(uint8_t hue);
 
@@ -60,14 +151,28 @@ void pattern_Init(void) {
    BeaconClock = 0;
    BeaconClockInterval = BeaconIntervalRampMS[BeaconClockRampPosition];
    // Start one tick in to allow for time manipulation
-   LastBeaconClockTime = BeaconClockInterval;
+   LastBeaconClockTime = MS_TO_US(BeaconClockInterval);
+   NumPhaseSamples = 0;
+   PhaseRateUS = 0;
+   BeaconPending = false;
+   GossipPending = false;
+   BeaconEvery = 1;
+   TicksSinceBeacon = 0;
+
+   EpochTickMS = BeaconClockInterval;
+   BeaconsUntilEpoch = 0;
+
+   ButtonPressed = false;
+   LastButtonTime = 0;
 
    HueClock = 0;
    HueClockPeriod = HUE_PERIOD_MS_FOR_BEACON(BeaconClockInterval);
-   LastHueClockTime = HueClockPeriod;
+   LastHueClockTime = MS_TO_US(HueClockPeriod);
 
    //TODO pass in a CB for each RX'd beacon?
    beacon_Init();
+   nbr_Init();
+   gossip_Init();
 
    led_StartAnimation();
 
@@ -79,26 +184,55 @@ void pattern_Init(void) {
    //TODO maybe try HueClockPeriod * 2 for 2nd param?
    led_SetAnimationSpeeds(HueClockPeriod, BeaconClockInterval);
    //led_SetAnimationSpeeds(HueClockPeriod, HueClockPeriod);
+
+   // Nobody around yet
+   led_SetSlowFrames(true);
 }
 
-void pattern_GiveTime(uint32_t const systimeMS) {
+void pattern_GiveTime(uint32_t const systimeUS) {
+   TIMING_SCOPE(TS_PatternGiveTime);
    uint8_t trueHue;
-   uint16_t lastBeacon;
+   int32_t trimPPM;
+   bool withEpoch;
+   struct beacon_Beacon lastBeacon;
+   struct beacon_Beacon gossip;
+
+   beacon_GiveTime();
 
    if(beacon_Receive(&lastBeacon)) {
       // If we saw a beacon, handle it
-      pattern_SawBeacon(lastBeacon);
+      pattern_SawBeacon(&lastBeacon);
+   }
+
+   // Hearing that beacon may have had us trim the HSI, which changes how fast
+   // we run by a known amount. Make up for it from here on without waiting to
+   // learn it from the neighbors, and for what went by at the old speed.
+   trimPPM = ct_TakeSteps() * CT_STEP_PPM;
+   if(trimPPM != 0) {
+      PhaseRateUS = MAX(MIN(PhaseRateUS + trimPPM, PHASE_RATE_MAX_US), -PHASE_RATE_MAX_US);
+      pattern_ShiftClocks(-trimPPM * (int32_t)((systimeUS - LastBeaconClockTime) / 1000) / 1000);
+   }
+
+   if(ButtonPressed) {
+      ButtonPressed = false;
+
+      if(systimeUS - LastButtonTime > BUTTON_DEBOUNCE_US) {
+         // Next mode, for everyone
+         gossip_Originate((pattern_Mode() + 1) % PM_Count);
+         pattern_ApplyMode();
+      }
+      LastButtonTime = systimeUS;
    }
 
    // On Hue tick (frequent)
-   if(systimeMS - LastHueClockTime >= HueClockPeriod) {
-      LastHueClockTime = systimeMS;
+   if(pattern_TimeUntil(systimeUS, LastHueClockTime, MS_TO_US(HueClockPeriod)) == 0) {
+      LastHueClockTime = systimeUS;
 
       // Re-use the period calculation to figure out how many sections to break
       // the 255 position color wheel into
       trueHue = HueClock * HUE_PERIOD_MS_FOR_BEACON(255);
 
-      iprintf("H(%d) ", HueClock);
+      LOG_DEBUG("H(%d) ", HueClock);
 
       //pattern_UpdateSimpleHue(trueHue);
       pattern_UpdateAnimation(trueHue);
@@ -108,34 +242,128 @@ void pattern_GiveTime(uint32_t const systimeMS) {
    }
 
    //  On Beacon tick (infrequent)
-   if(systimeMS - LastBeaconClockTime > BeaconClockInterval) {
-      LastBeaconClockTime = systimeMS;
+   if(pattern_TimeUntil(systimeUS, LastBeaconClockTime, (BeaconClockInterval / PATTERN_INTERVAL_GRID_MS) * pattern_GridUS() + 1) == 0) {
+      // Step along the grid rather than to now. The interval may have just
+      // shortened under us, and however late we got here mustn't carry over.
+      uint32_t const steps = (systimeUS - LastBeaconClockTime) / pattern_GridUS();
+      LastBeaconClockTime += steps * pattern_GridUS();
+      EpochTickMS += steps * PATTERN_INTERVAL_GRID_MS;
+
+      LOG_DEBUG("Beacon Clock Tick!\n");
+
+      // Don't send right away. If we're in sync with our neighbors so are their
+      // beacons, so everyone picks a slot to go out in. Skipping this tick
+      // mustn't leave more than BEACON_MAX_GAP_MS since the last one. Gossip
+      // backs off by ticks, not beacons, and always goes out when it's due.
+      GossipPending = gossip_ShouldAdvertise(&GossipVersion, &GossipSetting);
+      if(++TicksSinceBeacon >= MAX(BeaconEvery, 1 + nbr_Count() / BEACONS_PER_INTERVAL) ||
+            (TicksSinceBeacon + 1) * (uint32_t)BeaconClockInterval > BEACON_MAX_GAP_MS ||
+            GossipPending) {
+         // The beacon says which slot it went in, so that has to be one still to
+         // come. A late tick (the interval shortened) may have none left, and
+         // then it waits for the next.
+         BeaconSlot = MAX(rng_Below(BEACON_TX_SLOTS),
+               MIN((systimeUS - LastBeaconClockTime) / BEACON_TX_SLOT_US + 1, BEACON_TX_SLOTS));
+         if(BeaconSlot < BEACON_TX_SLOTS) {
+            TicksSinceBeacon = 0;
+            BeaconPending = true;
+         }
+      }
 
-      iprintf("Beacon Clock Tick!\n");
+      // Reset Hue clock too
+      HueClock = 0;
+      LastHueClockTime = LastBeaconClockTime;
 
-      //FIXME don't send hue, that changes and doesn't matter
-      //CRC8 of ID?
-      iprintf("(Hue %d) ", HueClock);
+      pattern_CorrectPhase();
 
-      beacon_Send(HueClock);
+      // Neighbors age out, so this is where we slow back down when left alone
+      pattern_SetBeaconInterval(nbr_Count());
+   }
 
-      // Reset Hue clock too
-      HueClock = 0;
-      LastHueClockTime = systimeMS;
+   if(BeaconPending && pattern_TimeUntil(systimeUS, LastBeaconClockTime, BeaconSlot * BEACON_TX_SLOT_US) == 0 &&
+         BeaconSlot < BEACON_TX_SLOTS - 1 && beacon_ChannelBusy()) {
+      // Someone else's burst is on the air. Ours goes in the next slot, which
+      // it carries, so the tick still comes out right. The last one goes anyway.
+      BeaconSlot++;
+   }
+
+   if(BeaconPending && pattern_TimeUntil(systimeUS, LastBeaconClockTime, BeaconSlot * BEACON_TX_SLOT_US) == 0) {
+      BeaconPending = false;
+
+      withEpoch = (BeaconsUntilEpoch == 0);
+
+      gossip.type = BT_Gossip;
+      gossip.version = GossipVersion;
+      gossip.setting = GossipSetting;
+
+      if(beacon_Send(EpochTickMS, BeaconSlot, withEpoch,
+               GossipPending ? &gossip : NULL)) {
+         BeaconsUntilEpoch = withEpoch ? EPOCH_EVERY_N_BEACONS : BeaconsUntilEpoch - 1;
+      }
 
-      pattern_SetBeaconInterval(BIC_Decrease);
+      LOG_DEBUG("(Slot %d Epoch %d Gossip %d) ", BeaconSlot, withEpoch,
+            GossipPending);
    }
 }
 
+/*
+ * How long until pattern_GiveTime() has something to do (short of receiving a
+ * beacon or a button press), in us. Lets the caller sleep until then.
+ */
+uint32_t pattern_TimeToNextEvent(uint32_t const systimeUS) {
+   uint32_t next = beacon_TimeToNextEvent();
+
+   if(ButtonPressed) {
+      return 0;
+   }
+
+   next = MIN(next, pattern_TimeUntil(systimeUS, LastHueClockTime, MS_TO_US(HueClockPeriod)));
+   next = MIN(next, pattern_TimeUntil(systimeUS, LastBeaconClockTime, (BeaconClockInterval / PATTERN_INTERVAL_GRID_MS) * pattern_GridUS() + 1));
+   if(BeaconPending) {
+      next = MIN(next, pattern_TimeUntil(systimeUS, LastBeaconClockTime, BeaconSlot * BEACON_TX_SLOT_US));
+   }
+   return next;
+}
+
+void pattern_GetStatus(struct pattern_Status * const status) {
+   status->beaconTickUS = LastBeaconClockTime;
+   status->phaseRateUS = PhaseRateUS;
+   status->beaconIntervalMS = BeaconClockInterval;
+   status->epochMS = EpochTickMS;
+   status->neighbors = nbr_Count();
+   status->mode = pattern_Mode();
+   status->sending = beacon_IsSending();
+   status->receiving = beacon_IsReceiving();
+}
+
+/*
+ * Only send a beacon every so many beacon clock ticks, to save power. 1 for
+ * every tick. Slow intervals get fewer skipped, to stay within
+ * BEACON_MAX_GAP_MS.
+ */
+void pattern_SetBeaconEvery(uint8_t every) {
+   BeaconEvery = MAX(every, 1);
+}
+
+/*
+ * Called from the button ISR, so just make a note of it.
+ */
+void pattern_ButtonPressed(void) {
+   ButtonPressed = true;
+}
+
 /*
  * When running the animation, update the channel bias and value.
  */
 static void pattern_UpdateAnimation(uint8_t hue) {
+   if(pattern_Mode() != PM_Crowd) {
+      hue = ModeHues[pattern_Mode()];
+   }
+
    //TODO get weight from table
    led_SetBiasValue(hue);
 
-   //FIXME rm
-   iprintf("Bias value to %d\n", hue);
+   LOG_DEBUG("Bias value to %d\n", hue);
 }
 
 /*
@@ -151,64 +379,210 @@ static void pattern_UpdateSimpleHue(uint8_t hue) {
    }
 }
 
-void pattern_SawBeacon(uint16_t rawBeacon) {
-   uint16_t beaconBump;
+void pattern_SawBeacon(struct beacon_Beacon const * const beacon) {
+   int32_t phaseError;
+
+   if(beacon->type == BT_Epoch) {
+      pattern_SawEpoch(beacon);
+      return;
+   }
+
+   if(beacon->type == BT_Gossip) {
+      if(gossip_Heard(beacon->version, beacon->setting)) {
+         pattern_ApplyMode();
+      }
+      return;
+   }
 
-   // Advance beacon interval ramp to speed it up
-   pattern_SetBeaconInterval(BIC_Increase);
+   // Move along the interval ramp by how many badges are really around
+   nbr_Saw(beacon->senderID);
+   pattern_SetBeaconInterval(nbr_Count());
 
    // Now that we have the new Beacon period, continue
 
-   // Jump the beacon clock 'forward' when a beacon comes in
-   // Moving last time back is == moving next time sooner
-   //FIXME rm
-   iprintf("LastClock %d --(", LastHueClockTime);
-   beaconBump = GET_BEACON_BUMP(BeaconClockInterval);
-   LastHueClockTime -= beaconBump;
-   iprintf("%d)--> %d\n", beaconBump, LastHueClockTime);
+   // Positive error means they ticked after us, so we'll pull our tick later
+   phaseError = pattern_PhaseError(beacon->tickUS);
+
+   if(beacon->epochTag != BEACON_EPOCH_TAG(pattern_EpochAt(beacon->tickUS)) ||
+         abs(phaseError) > MS_TO_US(PATTERN_EPOCH_MATCH_MS)) {
+      // Someone from another crowd, or counting the same ticks as us but far
+      // enough out of phase that they may as well be. Don't drag each other
+      // around, swap epochs (next beacon) and let the older crowd take the
+      // younger one over. Our own crowd lands here too when its epochs
+      // straddle a tag step, which only costs an early epoch. The tag
+      // wrapping is in beacons.h.
+      LOG_DEBUG("Foreign epoch tag %d\n", beacon->epochTag);
+      BeaconsUntilEpoch = 0;
+      return;
+   }
 
-   //FIXME do we want this? Causes a jump (but there would be one either way)
-   // Rescale the Hue clock too so we still get a full cycle, but faster
-   HueClockPeriod = HUE_PERIOD_MS_FOR_BEACON(BeaconClockInterval - beaconBump);
+   LOG_DEBUG("Phase error %c%dus\n", (phaseError < 0) ? '-' : '+', abs(phaseError));
+   if(NumPhaseSamples < PHASE_SAMPLES) {
+      PhaseSamples[NumPhaseSamples++] = phaseError;
+   }
 }
 
 /*
- * This fires whenever the general animation behavior is changing.
+ * Oldest epoch wins. Join an older crowd outright (epoch and phase both) so the
+ * patterns line up immediately instead of converging beacon by beacon. Ticking
+ * earlier on the same count makes them older by the phase error. After the
+ * shift their tick is on our grid, so the rest is whole grid steps.
  */
-static void pattern_SetBeaconInterval(enum BeaconIntervalChoice c) {
-   uint8_t newBias;
+static void pattern_SawEpoch(struct beacon_Beacon const * const beacon) {
+   int32_t const phaseError = pattern_PhaseError(beacon->tickUS);
+   int32_t const age = (int32_t)(beacon->epoch - pattern_EpochAt(beacon->tickUS)) - phaseError / 1000;
 
-   //FIXME rm
-   iprintf("BeaconRamp %d ->", BeaconClockRampPosition);
+   if(age > PATTERN_EPOCH_MATCH_MS) {
+      LOG_INFO("Joining older crowd (+%dms)\n", (int)age);
 
-   if(c == BIC_Increase) {
-      // Move UP interval ramp
+      pattern_ShiftClocks(phaseError);
+      EpochTickMS += beacon->epoch - pattern_EpochAt(beacon->tickUS);
 
-      BeaconClockRampPosition++;
-      if(BeaconClockRampPosition > BEACON_INTERVAL_RAMP_LEN) {
-         BeaconClockRampPosition = BEACON_INTERVAL_RAMP_LEN;
-      }
+      // Pass it on
+      BeaconsUntilEpoch = 0;
+   }
+   else if(age < -PATTERN_EPOCH_MATCH_MS) {
+      // They're younger, make sure they hear about us soon
+      BeaconsUntilEpoch = 0;
    }
-   else if(c == BIC_Decrease) {
-      // Move DOWN interval ramp
+}
 
-      if(BeaconClockRampPosition > 0) {
-         BeaconClockRampPosition--;
-      }
+/*
+ * The beacon says exactly when the sender's clock ticked, so we know how far
+ * out of phase we are. Wrapped into +/- half a grid step.
+ */
+static int32_t pattern_PhaseError(uint32_t tickUS) {
+   int32_t const grid = pattern_GridUS();
+   int32_t phaseError;
+
+   phaseError = (int32_t)(tickUS - LastBeaconClockTime) % grid;
+   if(phaseError > grid / 2) {
+      phaseError -= grid;
+   }
+   else if(phaseError < -(grid / 2)) {
+      phaseError += grid;
    }
+   return phaseError;
+}
+
+/*
+ * Time left until a period that started at lastUS is up, 0 if it already is.
+ * Clock shifts can leave lastUS in the future, which just means a longer wait.
+ */
+static uint32_t pattern_TimeUntil(uint32_t nowUS, uint32_t lastUS, uint32_t periodUS) {
+   int32_t const elapsed = (int32_t)(nowUS - lastUS);
 
-   //FIXME rm
-   iprintf(" %d", BeaconClockRampPosition);
+   return (elapsed >= (int32_t)periodUS) ? 0 : periodUS - elapsed;
+}
+
+/*
+ * Our crowd epoch at the grid step nearest some (nearby) local time. A
+ * neighbor in phase ticking then counts exactly this.
+ */
+static uint32_t pattern_EpochAt(uint32_t timeUS) {
+   int32_t const grid = pattern_GridUS();
+   int32_t const sinceTick = (int32_t)(timeUS - LastBeaconClockTime);
+
+   return EpochTickMS + PATTERN_INTERVAL_GRID_MS *
+      ((sinceTick + ((sinceTick < 0) ? -grid : grid) / 2) / grid);
+}
+
+/*
+ * One step of the interval grid by our clock, stretched by how much faster it
+ * runs than the crowd's
+ */
+static int32_t pattern_GridUS(void) {
+   return MS_TO_US(PATTERN_INTERVAL_GRID_MS) + PhaseRateUS * (PATTERN_INTERVAL_GRID_MS / 1000);
+}
+
+/*
+ * Move both clocks' last tick by the same amount, keeping them in step. The
+ * epoch goes with them, it's counted from the tick.
+ */
+static void pattern_ShiftClocks(int32_t deltaUS) {
+   LastBeaconClockTime += deltaUS;
+   LastHueClockTime += deltaUS;
+}
+
+/*
+ * Once a tick, move towards the mean of the phase errors heard since the last
+ * one, and learn how much faster than the crowd our clock runs.
+ */
+static void pattern_CorrectPhase(void) {
+   int32_t const seconds = BeaconClockInterval / 1000;
+   int32_t sample;
+   int i;
+
+   if(NumPhaseSamples == 0) {
+      return;
+   }
+
+   sample = 0;
+   for(i = 0; i < NumPhaseSamples; i++) {
+      sample += MAX(MIN(PhaseSamples[i], PHASE_SAMPLE_MAX_US), -PHASE_SAMPLE_MAX_US);
+   }
+   sample /= NumPhaseSamples;
+   pattern_ShiftClocks(sample / (1 << PHASE_CORRECTION_SHIFT));
+   NumPhaseSamples = 0;
+
+   PhaseRateUS -= PhaseRateUS / (1 << PHASE_RATE_LEAK_SHIFT);
+   PhaseRateUS += sample / (seconds << PHASE_RATE_SHIFT);
+   PhaseRateUS = MAX(MIN(PhaseRateUS, PHASE_RATE_MAX_US), -PHASE_RATE_MAX_US);
+}
+
+/*
+ * This fires whenever the general animation behavior is changing.
+ */
+static void pattern_SetBeaconInterval(uint8_t rampPosition) {
+   uint8_t newBias;
+
+   // Anything past the end of the ramp is just a big crowd
+   if(rampPosition >= BEACON_INTERVAL_RAMP_LEN) {
+      rampPosition = BEACON_INTERVAL_RAMP_LEN - 1;
+   }
+
+   if(rampPosition == BeaconClockRampPosition) {
+      return;
+   }
+
+   LOG_DEBUG("BeaconRamp %d -> %d", BeaconClockRampPosition, rampPosition);
+
+   BeaconClockRampPosition = rampPosition;
+   metrics_Set(MID_RampPosition, rampPosition);
 
    //TODO add jitter to the BeaconClockInterval to avoid a perfect sync
    BeaconClockInterval = BeaconIntervalRampMS[BeaconClockRampPosition];
    HueClockPeriod = HUE_PERIOD_MS_FOR_BEACON(BeaconClockInterval);
 
-   newBias = BiasWeightRamp[BeaconClockRampPosition];
+   newBias = (pattern_Mode() == PM_Crowd) ? BiasWeightRamp[BeaconClockRampPosition] : 100;
    led_SetBiasWeight(newBias);
-   //FIXME rm
-   iprintf(" Bias weight to %d perc\n", newBias);
+   LOG_DEBUG(" Bias weight to %d perc\n", newBias);
 
    led_SetAnimationSpeeds(HueClockPeriod, BeaconClockInterval);
+   led_SetSlowFrames(BeaconClockRampPosition == 0);
+}
+
+
+/*
+ * The crowd mode changed. Show it now rather than at the next hue tick.
+ */
+static void pattern_ApplyMode(void) {
+   enum pattern_Mode const mode = pattern_Mode();
+
+   LOG_INFO("Mode %d\n", mode);
+
+   if(mode == PM_Crowd) {
+      led_SetBiasWeight(BiasWeightRamp[BeaconClockRampPosition]);
+   }
+   else {
+      // Fixed colors are all bias, whatever the crowd size
+      led_SetBiasWeight(100);
+      led_SetBiasValue(ModeHues[mode]);
+   }
 }
 
+static enum pattern_Mode pattern_Mode(void) {
+   uint8_t const setting = gossip_Setting();
+
+   return (setting < PM_Count) ? (enum pattern_Mode)setting : PM_Crowd;
+}
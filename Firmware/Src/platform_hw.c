@@ -1,10 +1,14 @@
 #include "platform_hw.h"
-#include "iprintf.h"
+#include "log.h"
+#include "metrics.h"
+#include "timing.h"
+#include "utilities.h"
 
 #include <string.h>
 
 // the UART used for iprintf
 UART_HandleTypeDef huart1;
+#define UART_BAUD                   (115200)
 
 static uint8_t const LED_FRAME_START[4] = {0x00, 0x00, 0x00, 0x00};
 static uint8_t const LED_FRAME_STOP[4]  = {0xFF, 0xFF, 0xFF, 0xFF};
@@ -13,24 +17,103 @@ static uint8_t const LED_FRAME_STOP[4]  = {0xFF, 0xFF, 0xFF, 0xFF};
 #define LED_GLOB_BRIGHTNESS_MIN     0x01
 #define LED_GLOB_BRIGHTNESS         (0x1)
 
-//pull in from outside
-union platformHW_LEDRegister  LedRegisterStates[LED_CHAIN_LENGTH] = {
-   {.header = 0x7, .globalBrightness = LED_GLOB_BRIGHTNESS},
-   {.header = 0x7, .globalBrightness = LED_GLOB_BRIGHTNESS},
-   {.header = 0x7, .globalBrightness = LED_GLOB_BRIGHTNESS},
-   {.header = 0x7, .globalBrightness = LED_GLOB_BRIGHTNESS},
-   {.header = 0x7, .globalBrightness = LED_GLOB_BRIGHTNESS},
-   {.header = 0x7, .globalBrightness = LED_GLOB_BRIGHTNESS},
-   {.header = 0x7, .globalBrightness = LED_GLOB_BRIGHTNESS},
-   {.header = 0x7, .globalBrightness = LED_GLOB_BRIGHTNESS},
-   {.header = 0x7, .globalBrightness = LED_GLOB_BRIGHTNESS},
-   {.header = 0x7, .globalBrightness = LED_GLOB_BRIGHTNESS},
-};
+// APA102 current, datasheet typicals: this much each doing nothing, and a
+// channel this much more at full PWM and full global brightness
+#define LED_IDLE_UA                 (700 * LED_CHAIN_LENGTH)
+#define LED_CHANNEL_UA              (20000)
+// uA per unit of channel value times global brightness, Q8
+#define LED_UA_PER_PWM_Q8           ((LED_CHANNEL_UA << 8) / (255 * LED_GLOB_BRIGHTNESS_MAX))
+// What the chain may draw until platformHW_SetLEDBudget() says otherwise
+#define LED_BUDGET_UA               (60000)
+#define LED_UAMS_PER_MAH            (3600000000UL)
+
+// How much of each LED's value makes it out, Q8 (see
+// platformHW_SetLEDBrightness())
+static uint32_t LEDBrightnessQ8 = 1 << 8;
+
+// What the LEDs may draw, what the last frame out does, and what they've used
+// since boot: whole mAh, and uA ms towards the next
+static uint32_t LEDBudgetUA = LED_BUDGET_UA;
+static uint32_t LEDCurrentUA;
+static uint32_t LEDLastFrameMS;
+static uint32_t LEDChargeUAMS;
+
+// SysTick counts to convert into microseconds, Q16. Set up with the clock.
+static uint32_t MicrosPerCountQ16;
+// Time SysTick didn't count (stopped, or a ms cut short by a clock switch),
+// short of a whole ms tick, still to be added on
+static uint32_t CarryUS;
+// Running off the PLL at 48MHz, or straight off the HSI at 8
+static bool ClockFast;
+
+// The LEDs' SPI clock at most, whatever PCLK is. Slow enough for the logic
+// analyzer.
+#define LED_SPI_MAX_HZ              (3000000)
+
+// HAL's ms tick, moved on by whatever CarryUS adds up to
+extern __IO uint32_t uwTick;
+
+#ifdef STOP_MODE_ENABLED
+// The RTC runs off the LSI (~40kHz, give or take half) through all of stop
+// mode. Its subsecond counter ticks at LSI/2, ~50us, and comes back around
+// every 16384 ticks (~0.8s), which is the longest a stop can be.
+#define STOP_PREDIV_A               (1)
+#define STOP_PREDIV_S               (0x3FFF)
+#define STOP_TICKS_PER_SECOND       (STOP_PREDIV_S + 1)
+#define STOP_TICKS_PER_MINUTE       (60 * STOP_TICKS_PER_SECOND)
+// Ticks timed against SysTick to calibrate, ~10ms
+#define STOP_CALIBRATE_TICKS        (200)
+// Too short a stop isn't worth it, and the alarm has to be set in time
+#define STOP_MIN_TICKS              (4)
+// Wake this early, so the PLL's back by the time we were asked for
+#define STOP_WAKE_EARLY_TICKS       (4)
+
+// EXTI lines that end a stop, besides the button's. The receiver's output
+// (PA6) goes low when a carrier starts, USART1 RX (PA10) on a start bit.
+#define STOP_EXTI_IR                (EXTI_IMR_MR6)
+#define STOP_EXTI_UART              (EXTI_IMR_MR10)
+#define STOP_EXTI_ALARM             (EXTI_IMR_MR17)
+#define STOP_EXTI_ALL               (STOP_EXTI_IR | STOP_EXTI_UART | STOP_EXTI_ALARM)
+
+// RTC ticks to microseconds, Q16
+static uint32_t StopTickUSQ16;
+// The LSI and RTC are only started when first calibrated, off the boot path
+static bool StopReady;
+#endif
+
+// ADC reads folded into platformHW_Noise()
+#define NOISE_READS                 (64)
+
+// Fills RAM the stack hasn't reached yet, see platformHW_StackFree()
+#define STACK_PAINT                 (0x5A7AC4ED)
+// Left alone under the stack pointer while painting, for the painting itself
+#define STACK_PAINT_MARGIN_WORDS    (16)
+
+// from the linker script: .data and .bss, the end of .bss (the heap starts
+// here) and of RAM
+extern uint32_t _sdata;
+extern uint32_t _edata;
+extern uint32_t _sbss;
+extern uint32_t _ebss;
+extern uint32_t _estack;
 
 static void SystemClock_Config(void);
 static void Error_Handler(void);
 static void MX_GPIO_Init(void);
 static void MX_USART1_UART_Init(void);
+static void PaintStack(void);
+static void ClockChanged(void);
+static void AddCarry(uint32_t us);
+static uint32_t SpiPrescaler(uint32_t pclk);
+static void SpiWrite(SPI_TypeDef * const spi, uint8_t const *data, uint32_t len);
+static void LEDColor(struct color_ColorHSV const * const hsv, struct color_ColorRGB * const rgb);
+#ifdef STOP_MODE_ENABLED
+static void StopInit(void);
+static uint32_t StopTicks(void);
+static uint32_t StopTicksSince(uint32_t start);
+static uint32_t StopTickEdge(void);
+static void StopRestoreClock(void);
+#endif
 
 
 /*
@@ -40,6 +123,10 @@ bool platformHW_Init(void) {
    // Configure the system clock
    SystemClock_Config();
 
+   // At 48MHz, so it's done in a sixth of the time. Nothing before it goes
+   // anywhere near as deep as what comes after.
+   PaintStack();
+
    // Initialize all configured peripherals
    MX_GPIO_Init();
    MX_USART1_UART_Init();
@@ -47,20 +134,381 @@ bool platformHW_Init(void) {
    return true;
 }
 
-void platformHW_UpdateLEDs(SPI_HandleTypeDef* spi) {
+/*
+ * Send a frame of LED_CHAIN_LENGTH colors. They only become RGB here, once per
+ * LED into the stack for the length of the call, so no RGB copy of the frame
+ * is kept. Scaled down as a whole if it would draw more than the budget: the
+ * estimate is the sum of every channel times the global brightness, and costs
+ * one divide per frame only when over.
+ */
+void platformHW_UpdateLEDs(SPI_HandleTypeDef* spi, struct color_ColorHSV const * const leds) {
+   TIMING_SCOPE(TS_UpdateLEDs);
+   uint32_t const nowMS = HAL_GetTick();
+   uint32_t pwm = 0, pwmUA, scaleQ8 = 1 << 8;
+   union platformHW_LEDRegister out = {.header = 0x7, .globalBrightness = LED_GLOB_BRIGHTNESS};
+   struct color_ColorRGB rgb[LED_CHAIN_LENGTH];
    int i;
 
-   //TODO we have to strip the const here. That's ok, right? Read the SRC
-   //TODO what is a better timeout here?
-   HAL_SPI_Transmit(spi, (uint8_t*)LED_FRAME_START, sizeof(LED_FRAME_START), 10000);
+   for(i = 0; i < LED_CHAIN_LENGTH; i++) {
+      LEDColor(&leds[i], &rgb[i]);
+      pwm += rgb[i].r + rgb[i].g + rgb[i].b;
+   }
+   pwmUA = (pwm * LED_GLOB_BRIGHTNESS * LED_UA_PER_PWM_Q8) >> 8;
+
+   if(LED_IDLE_UA + pwmUA > LEDBudgetUA) {
+      scaleQ8 = ((LEDBudgetUA > LED_IDLE_UA ? LEDBudgetUA - LED_IDLE_UA : 0) << 8) / pwmUA;
+      pwmUA = (pwmUA * scaleQ8) >> 8;
+      metrics_Count(MID_LEDFramesLimited);
+   }
+
+   // The last frame was showing until now
+   LEDChargeUAMS += LEDCurrentUA * (nowMS - LEDLastFrameMS);
+   while(LEDChargeUAMS >= LED_UAMS_PER_MAH) {
+      LEDChargeUAMS -= LED_UAMS_PER_MAH;
+      metrics_Count(MID_LEDmAh);
+   }
+   LEDLastFrameMS = nowMS;
+   LEDCurrentUA = LED_IDLE_UA + pwmUA;
+   metrics_Set(MID_LEDmA, LEDCurrentUA / 1000);
+
+   // ClockChanged() leaves it off
+   spi->Instance->CR1 |= SPI_CR1_SPE;
+   SpiWrite(spi->Instance, LED_FRAME_START, sizeof(LED_FRAME_START));
 
    for(i = 0; i < LED_CHAIN_LENGTH; i++) {
-      HAL_SPI_Transmit(spi, LedRegisterStates[i].raw, 4, 10000);
+      out.color = rgb[i];
+      if(scaleQ8 != (1 << 8)) {
+         out.color.r = (out.color.r * scaleQ8) >> 8;
+         out.color.g = (out.color.g * scaleQ8) >> 8;
+         out.color.b = (out.color.b * scaleQ8) >> 8;
+      }
+      SpiWrite(spi->Instance, out.raw, sizeof(out.raw));
+   }
+
+   SpiWrite(spi->Instance, LED_FRAME_STOP, sizeof(LED_FRAME_STOP));
+}
+
+/*
+ * The IR timers' hot paths, straight onto the registers: what the HAL calls
+ * they replace do, less the checks and locking. Only for timers with nothing
+ * but channel 1 in use, so stopping one stops its counter outright.
+ */
+void platformHW_TimStartIT(TIM_HandleTypeDef * const tim) {
+   tim->Instance->DIER |= TIM_DIER_UIE;
+   tim->Instance->CR1 |= TIM_CR1_CEN;
+}
+
+void platformHW_TimStopIT(TIM_HandleTypeDef * const tim) {
+   tim->Instance->DIER &= ~TIM_DIER_UIE;
+   tim->Instance->CR1 &= ~TIM_CR1_CEN;
+}
+
+/*
+ * Channel 1's output on and off, for TIM15-17 (the ones with a break and
+ * dead time unit, whose outputs also need MOE).
+ */
+void platformHW_TimPWMStart(TIM_HandleTypeDef * const tim) {
+   tim->Instance->CCER |= TIM_CCER_CC1E;
+   tim->Instance->BDTR |= TIM_BDTR_MOE;
+   tim->Instance->CR1 |= TIM_CR1_CEN;
+}
+
+void platformHW_TimPWMStop(TIM_HandleTypeDef * const tim) {
+   tim->Instance->CCER &= ~TIM_CCER_CC1E;
+   tim->Instance->BDTR &= ~TIM_BDTR_MOE;
+   tim->Instance->CR1 &= ~TIM_CR1_CEN;
+}
+
+uint32_t platformHW_TimCapture(TIM_HandleTypeDef * const tim) {
+   return tim->Instance->CCR1;
+}
+
+/*
+ * Scale every LED's value, as a %. Takes effect from the next frame.
+ */
+void platformHW_SetLEDBrightness(uint8_t percent) {
+   LEDBrightnessQ8 = ((percent < 100 ? percent : 100) << 8) / 100;
+}
+
+/*
+ * What the LEDs may draw, in uA, idle current included. Frames that would draw
+ * more are dimmed to fit.
+ */
+void platformHW_SetLEDBudget(uint32_t ua) {
+   LEDBudgetUA = ua;
+}
+
+/*
+ * What the LEDs are estimated to draw showing the last frame, in uA.
+ */
+uint32_t platformHW_GetLEDCurrentUA(void) {
+   return LEDCurrentUA;
+}
+
+/*
+ * A microsecond timestamp built from the ms tick plus the SysTick down counter.
+ * Wraps every ~71 minutes, so only ever compare differences. Safe to call from
+ * ISRs (the ones that use it all share SysTick's priority, so it can't slip in
+ * underneath us).
+ */
+uint32_t platformHW_GetMicros(void) {
+   uint32_t const primask = __get_PRIMASK();
+   uint32_t ms, count;
+
+   __disable_irq();
+   ms = HAL_GetTick();
+   count = SysTick->VAL;
+   // the counter reloaded but the tick ISR hasn't caught up yet
+   if((SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) && (count > (SysTick->LOAD / 2))) {
+      ms++;
+   }
+   __set_PRIMASK(primask);
+
+   return (ms * 1000) + (((SysTick->LOAD - count) * MicrosPerCountQ16) >> 16) + CarryUS;
+}
+
+/*
+ * Bytes between the end of .bss and the deepest the stack has been since boot
+ * (or the heap, if anyone ever mallocs).
+ */
+uint32_t platformHW_StackFree(void) {
+   uint32_t const *p = &_ebss;
+
+   while(p < &_estack && *p == STACK_PAINT) {
+      p++;
+   }
+   return (p - &_ebss) * sizeof(*p);
+}
+
+/*
+ * Bytes of RAM taken up front, .data and .bss. What's left after them and
+ * platformHW_StackFree() is the most the stack has used.
+ */
+uint32_t platformHW_StaticRAM(void) {
+   return ((&_edata - &_sdata) + (&_ebss - &_sbss)) * sizeof(uint32_t);
+}
+
+/*
+ * 32 bits of noise, to seed with: the temperature sensor read at the shortest
+ * sample time, before it's even settled, and the low bits of every read
+ * folded together. Not much entropy per read, but it doesn't need much. Leaves
+ * the ADC off, for power_Init() to set up its own way.
+ */
+uint32_t platformHW_Noise(void) {
+   uint32_t noise = SysTick->VAL;
+   int i;
+
+   __HAL_RCC_ADC1_CLK_ENABLE();
+   ADC1->CFGR2 = ADC_CFGR2_CKMODE_1;
+   ADC1->CR = ADC_CR_ADCAL;
+   while(ADC1->CR & ADC_CR_ADCAL) { }
+
+   ADC1_COMMON->CCR |= ADC_CCR_TSEN;
+   ADC1->CHSELR = ADC_CHSELR_CHSEL16;
+   ADC1->SMPR = 0;
+
+   ADC1->ISR = ADC_ISR_ADRDY;
+   ADC1->CR |= ADC_CR_ADEN;
+   while(!(ADC1->ISR & ADC_ISR_ADRDY)) { }
+
+   for(i = 0; i < NOISE_READS; i++) {
+      ADC1->CR |= ADC_CR_ADSTART;
+      while(!(ADC1->ISR & ADC_ISR_EOC)) { }
+      // Rotated, so each read's low bits land on new ones
+      noise = ((noise << 5) | (noise >> 27)) ^ ADC1->DR;
+   }
+
+   ADC1->CR |= ADC_CR_ADDIS;
+   while(ADC1->CR & ADC_CR_ADEN) { }
+   ADC1_COMMON->CCR &= ~ADC_CCR_TSEN;
+
+   return noise;
+}
+
+/*
+ * Move the HSI trim (and with it the PLL, SysTick and every timer) by some
+ * number of steps, each roughly 0.5%. Clamped to the 5 bit range, returns the
+ * trim we ended up at.
+ */
+uint8_t platformHW_TrimHSI(int8_t steps) {
+   int16_t const trimMax = RCC_CR_HSITRIM_Msk >> RCC_CR_HSITRIM_Pos;
+   int16_t trim = (RCC->CR & RCC_CR_HSITRIM) >> RCC_CR_HSITRIM_Pos;
+
+   trim = MAX(0, MIN(trimMax, trim + steps));
+   __HAL_RCC_HSI_CALIBRATIONVALUE_ADJUST(trim);
+
+   return trim;
+}
+
+/*
+ * Switch between 48MHz off the PLL and 8MHz straight off the HSI, with the PLL
+ * off. SysTick (so the ms tick and platformHW_GetMicros()), USART1 and the
+ * LEDs' SPI are set up again for the new clock. Any other timer is up to its
+ * owner, using HAL_RCC_GetPCLK1Freq().
+ *
+ * Refuses, returning false, with a byte going out or coming in on USART1,
+ * which has to be stopped to change its baud rate.
+ */
+bool platformHW_SetClock(bool fast) {
+   uint32_t const primask = __get_PRIMASK();
+
+   if(fast == ClockFast) {
+      return true;
+   }
+
+   __disable_irq();
+   if((USART1->CR1 & USART_CR1_TXEIE) || !(USART1->ISR & USART_ISR_TC) ||
+         (USART1->ISR & (USART_ISR_BUSY | USART_ISR_RXNE))) {
+      __set_PRIMASK(primask);
+      return false;
+   }
+
+   if(fast) {
+      // Wait state before the clock goes up
+      FLASH->ACR = (FLASH->ACR & ~FLASH_ACR_LATENCY) | FLASH_LATENCY_1;
+      RCC->CR |= RCC_CR_PLLON;
+      while(!(RCC->CR & RCC_CR_PLLRDY)) { }
+      RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | RCC_CFGR_SW_PLL;
+      while((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL) { }
+   }
+   else {
+      RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | RCC_CFGR_SW_HSI;
+      while((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_HSI) { }
+      RCC->CR &= ~RCC_CR_PLLON;
+      // and none after it's come down
+      FLASH->ACR = (FLASH->ACR & ~FLASH_ACR_LATENCY) | FLASH_LATENCY_0;
+   }
+   ClockFast = fast;
+   ClockChanged();
+
+   __set_PRIMASK(primask);
+   metrics_Count(MID_ClockSwitches);
+   return true;
+}
+
+bool platformHW_IsClockFast(void) {
+   return ClockFast;
+}
+
+#ifdef STOP_MODE_ENABLED
+/*
+ * Stop mode until the IR receiver, USART1, the button or the RTC (maxUS from
+ * now, ~0.8s at most) wakes us. Then straight back to whichever clock we had,
+ * with the time moved on by however long we were out. Call with interrupts
+ * off, which they still are on return.
+ *
+ * Whatever woke us is lost: the receiver's first frame (the decoder times out
+ * what it caught of it, before the burst's next), the first character on the
+ * UART. Returns what it was, or 0 if we didn't stop (too soon to be
+ * worth it, or something in flight that stop would freeze).
+ */
+uint32_t platformHW_Stop(uint32_t maxUS) {
+   uint32_t ticks = ((uint64_t)maxUS << 16) / StopTickUSQ16;
+   uint32_t start, startUS, sleptUS, wake, pending, before, after;
+   int32_t missedUS;
+
+   if(ticks < STOP_MIN_TICKS + STOP_WAKE_EARLY_TICKS) {
+      return 0;
+   }
+   ticks = MIN(ticks - STOP_WAKE_EARLY_TICKS, (uint32_t)STOP_PREDIV_S);
+
+   // A byte part way out, or a frame part way in
+   if((USART1->CR1 & USART_CR1_TXEIE) || !(USART1->ISR & USART_ISR_TC) ||
+         !(GPIOA->IDR & GPIO_PIN_6)) {
+      return 0;
+   }
+
+   // From the start of a tick, so what's slept is whole ticks
+   start = StopTickEdge();
+   startUS = platformHW_GetMicros();
+
+   // The subsecond counter counts down, so that many ticks on is that much less
+   RTC->WPR = 0xCA;
+   RTC->WPR = 0x53;
+   RTC->CR &= ~(RTC_CR_ALRAE | RTC_CR_ALRAIE);
+   while(!(RTC->ISR & RTC_ISR_ALRAWF)) { }
+   RTC->ALRMAR = RTC_ALRMAR_MSK4 | RTC_ALRMAR_MSK3 | RTC_ALRMAR_MSK2 | RTC_ALRMAR_MSK1;
+   RTC->ALRMASSR = (15 << RTC_ALRMASSR_MASKSS_Pos) |
+      ((STOP_PREDIV_S - (start % STOP_TICKS_PER_SECOND) + STOP_TICKS_PER_SECOND - ticks) % STOP_TICKS_PER_SECOND);
+   RTC->ISR &= ~RTC_ISR_ALRAF;
+   RTC->CR |= RTC_CR_ALRAE | RTC_CR_ALRAIE;
+   RTC->WPR = 0xFF;
+
+   // Only to wake us. Interrupts are off, and everything's cleared again
+   // before they're back on, so the handlers never run.
+   EXTI->PR = STOP_EXTI_ALL;
+   EXTI->IMR |= STOP_EXTI_ALL;
+   NVIC_EnableIRQ(EXTI4_15_IRQn);
+   NVIC_EnableIRQ(RTC_IRQn);
+
+   HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_STOPENTRY_WFI);
+
+   // Running off the HSI until the PLL's locked. SysTick counts its clocks.
+   before = SysTick->VAL;
+   StopRestoreClock();
+   after = SysTick->VAL;
+
+   pending = EXTI->PR;
+   EXTI->IMR &= ~STOP_EXTI_ALL;
+   EXTI->PR = STOP_EXTI_ALL;
+   NVIC_DisableIRQ(EXTI4_15_IRQn);
+   NVIC_DisableIRQ(RTC_IRQn);
+   NVIC_ClearPendingIRQ(EXTI4_15_IRQn);
+   NVIC_ClearPendingIRQ(RTC_IRQn);
+
+   RTC->WPR = 0xCA;
+   RTC->WPR = 0x53;
+   RTC->CR &= ~(RTC_CR_ALRAE | RTC_CR_ALRAIE);
+   RTC->ISR &= ~RTC_ISR_ALRAF;
+   RTC->WPR = 0xFF;
+
+   // SysTick stood still while we were stopped. Make up what it missed: the
+   // time since the start (to the start of a tick again, so whole ticks) less
+   // what it did count.
+   sleptUS = ((uint64_t)((StopTickEdge() + STOP_TICKS_PER_MINUTE - start) % STOP_TICKS_PER_MINUTE) *
+         StopTickUSQ16) >> 16;
+   missedUS = sleptUS - (platformHW_GetMicros() - startUS);
+   if(missedUS > 0) {
+      AddCarry(missedUS);
+   }
+
+   wake = 0;
+   wake |= (pending & STOP_EXTI_IR) ? PLATFORMHW_WAKE_IR : 0;
+   wake |= (pending & STOP_EXTI_UART) ? PLATFORMHW_WAKE_UART : 0;
+   wake |= (pending & EXTI_PR_PR0) ? PLATFORMHW_WAKE_BUTTON : 0;
+   wake |= (pending & STOP_EXTI_ALARM) ? PLATFORMHW_WAKE_ALARM : 0;
+   if(!wake) {
+      wake = PLATFORMHW_WAKE_OTHER;
    }
 
-   HAL_SPI_Transmit(spi, (uint8_t*)LED_FRAME_STOP, sizeof(LED_FRAME_STOP), 10000);
+   metrics_Count(MID_Stops);
+   metrics_Set(MID_WakeMaxUS, MAX(metrics_Get(MID_WakeMaxUS),
+         ((before - after + SysTick->LOAD + 1) % (SysTick->LOAD + 1)) / (HSI_VALUE / 1000000)));
+
+   return wake;
 }
 
+/*
+ * Time the RTC's ticks against SysTick. The LSI is only good to +/-50% and
+ * wanders with temperature, so do it now and again. Takes ~10ms, with
+ * interrupts on. The first time, starts them both up as well.
+ */
+void platformHW_CalibrateStop(void) {
+   uint32_t start, startUS, ticks;
+
+   if(!StopReady) {
+      StopInit();
+      StopReady = true;
+   }
+   start = StopTickEdge();
+   startUS = platformHW_GetMicros();
+
+   while((ticks = StopTicksSince(start)) < STOP_CALIBRATE_TICKS) { }
+
+   StopTickUSQ16 = ((uint64_t)(platformHW_GetMicros() - startUS) << 16) / ticks;
+}
+#endif
+
 /** System Clock Configuration
  */
 void SystemClock_Config(void)
@@ -73,7 +521,7 @@ void SystemClock_Config(void)
     */
    RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI;
    RCC_OscInitStruct.HSIState = RCC_HSI_ON;
-   RCC_OscInitStruct.HSICalibrationValue = 16;
+   RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
    RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
    RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSI;
    RCC_OscInitStruct.PLL.PLLMUL = RCC_PLL_MUL12;
@@ -98,7 +546,8 @@ void SystemClock_Config(void)
 
    /**Configure the Systick interrupt time 
     */
-   HAL_SYSTICK_Config(HAL_RCC_GetHCLKFreq()/1000);
+   ClockFast = true;
+   ClockChanged();
 
    /**Configure the Systick 
     */
@@ -111,20 +560,196 @@ void SystemClock_Config(void)
 /* USART1 init function */
 static void MX_USART1_UART_Init(void)
 {
-
+   // Clock, pins and interrupt, as HAL_UART_Init() would have
    huart1.Instance = USART1;
-   huart1.Init.BaudRate = 115200;
-   huart1.Init.WordLength = UART_WORDLENGTH_8B;
-   huart1.Init.StopBits = UART_STOPBITS_1;
-   huart1.Init.Parity = UART_PARITY_NONE;
-   huart1.Init.Mode = UART_MODE_TX_RX;
-   huart1.Init.HwFlowCtl = UART_HWCONTROL_NONE;
-   huart1.Init.OverSampling = UART_OVERSAMPLING_16;
-   huart1.Init.OneBitSampling = UART_ONE_BIT_SAMPLE_DISABLE;
-   huart1.AdvancedInit.AdvFeatureInit = UART_ADVFEATURE_NO_INIT;
-   if (HAL_UART_Init(&huart1) != HAL_OK)
-   {
-      Error_Handler();
+   HAL_UART_MspInit(&huart1);
+
+   // 8N1, 16x oversampling
+   USART1->CR1 = 0;
+   USART1->CR2 = 0;
+   USART1->CR3 = 0;
+   USART1->BRR = (HAL_RCC_GetPCLK1Freq() + (UART_BAUD / 2)) / UART_BAUD;
+
+   // Bytes in are requests (see metrics.h), bytes out go through iprintf()
+   USART1->CR1 = USART_CR1_TE | USART_CR1_RE | USART_CR1_RXNEIE | USART_CR1_UE;
+}
+
+/*
+ * Everything platform_hw looks after that runs off HCLK/PCLK, for whatever
+ * the clock is now. SysTick starts a fresh ms, so take what it had counted
+ * first.
+ */
+static void ClockChanged(void) {
+   // Still counting at the old rate through the switch, near enough
+   AddCarry(((SysTick->LOAD - SysTick->VAL) * MicrosPerCountQ16) >> 16);
+   SystemCoreClockUpdate();
+
+   // Which also puts SysTick back at the lowest priority, so set it again
+   HAL_SYSTICK_Config(HAL_RCC_GetHCLKFreq()/1000);
+   HAL_NVIC_SetPriority(SysTick_IRQn, TICK_INT_PRIORITY, 0);
+   MicrosPerCountQ16 = (1000UL << 16) / (SysTick->LOAD + 1);
+
+   // Not set up yet on the way through SystemClock_Config()
+   if(USART1->CR1 & USART_CR1_UE) {
+      USART1->CR1 &= ~USART_CR1_UE;
+      USART1->BRR = (HAL_RCC_GetPCLK1Freq() + (UART_BAUD / 2)) / UART_BAUD;
+      USART1->CR1 |= USART_CR1_UE;
+   }
+   // Only ever sent to from the main loop, so never part way through a frame
+   if(LED_SPI_INSTANCE->CR1 & SPI_CR1_MSTR) {
+      LED_SPI_INSTANCE->CR1 &= ~SPI_CR1_SPE;
+      LED_SPI_INSTANCE->CR1 = (LED_SPI_INSTANCE->CR1 & ~SPI_CR1_BR) | SpiPrescaler(HAL_RCC_GetPCLK1Freq());
+   }
+}
+
+/*
+ * Time SysTick missed. Whole ms go on the tick, the rest waits for more.
+ */
+static void AddCarry(uint32_t us) {
+   CarryUS += us;
+   uwTick += CarryUS / 1000;
+   CarryUS %= 1000;
+}
+
+/*
+ * The smallest of SPI's power of two dividers that keeps SCK under
+ * LED_SPI_MAX_HZ.
+ */
+static uint32_t SpiPrescaler(uint32_t pclk) {
+   uint32_t br = 0;
+
+   while(br < (SPI_CR1_BR >> SPI_CR1_BR_Pos) && (pclk >> (br + 1)) > LED_SPI_MAX_HZ) {
+      br++;
+   }
+   return br << SPI_CR1_BR_Pos;
+}
+
+/*
+ * Out a byte at a time, and back once the last is on the wire. Nothing's
+ * listening on MISO, so what came in is thrown away after, overrun and all.
+ */
+static void SpiWrite(SPI_TypeDef * const spi, uint8_t const *data, uint32_t len) {
+   while(len--) {
+      while(!(spi->SR & SPI_SR_TXE)) { }
+      // A byte wide write, or the FIFO takes two frames' worth
+      *(__IO uint8_t *)&spi->DR = *data++;
+   }
+   while(spi->SR & SPI_SR_BSY) { }
+
+   while(spi->SR & SPI_SR_FRLVL) {
+      (void)*(__IO uint8_t *)&spi->DR;
+   }
+   (void)spi->SR;
+}
+
+/*
+ * One LED as it goes out: dimmed, then RGB.
+ */
+static void LEDColor(struct color_ColorHSV const * const hsv, struct color_ColorRGB * const rgb) {
+   struct color_ColorHSV dimmed = *hsv;
+
+   dimmed.v = (dimmed.v * LEDBrightnessQ8) >> 8;
+   color_HSV2RGB(&dimmed, rgb);
+}
+
+#ifdef STOP_MODE_ENABLED
+/*
+ * The RTC, off the LSI, for timing and waking from stop. Nothing else uses
+ * it, so no calendar: all that matters is that it counts.
+ */
+static void StopInit(void) {
+   __HAL_RCC_PWR_CLK_ENABLE();
+   PWR->CR |= PWR_CR_DBP;
+
+   RCC->CSR |= RCC_CSR_LSION;
+   while(!(RCC->CSR & RCC_CSR_LSIRDY)) { }
+
+   // The backup domain lives through resets. Its clock can only be chosen
+   // once, so start it over if it was anything else.
+   if((RCC->BDCR & RCC_BDCR_RTCSEL) != RCC_BDCR_RTCSEL_LSI) {
+      RCC->BDCR |= RCC_BDCR_BDRST;
+      RCC->BDCR &= ~RCC_BDCR_BDRST;
+      RCC->BDCR |= RCC_BDCR_RTCSEL_LSI;
+   }
+   RCC->BDCR |= RCC_BDCR_RTCEN;
+
+   RTC->WPR = 0xCA;
+   RTC->WPR = 0x53;
+   RTC->ISR |= RTC_ISR_INIT;
+   while(!(RTC->ISR & RTC_ISR_INITF)) { }
+   // Two writes, synchronous first
+   RTC->PRER = STOP_PREDIV_S;
+   RTC->PRER |= (STOP_PREDIV_A << RTC_PRER_PREDIV_A_Pos);
+   RTC->ISR &= ~RTC_ISR_INIT;
+   // Read the counters themselves, not the shadows two RTC clocks behind
+   RTC->CR |= RTC_CR_BYPSHAD;
+   RTC->WPR = 0xFF;
+
+   // Lines 6 and 10 are on port A out of reset. Only unmasked while stopped.
+   EXTI->FTSR |= STOP_EXTI_IR | STOP_EXTI_UART;
+   EXTI->RTSR |= STOP_EXTI_ALARM;
+
+   // Nominal until calibrated
+   StopTickUSQ16 = ((1000000ULL << 16) * (STOP_PREDIV_A + 1)) / LSI_VALUE;
+}
+
+/*
+ * The RTC's time within the minute, in ticks. Read until the subsecond
+ * counter holds still around the seconds.
+ */
+static uint32_t StopTicks(void) {
+   uint32_t ss, tr;
+
+   do {
+      ss = RTC->SSR;
+      tr = RTC->TR;
+   } while(ss != RTC->SSR);
+
+   return ((((tr & RTC_TR_ST) >> RTC_TR_ST_Pos) * 10) + ((tr & RTC_TR_SU) >> RTC_TR_SU_Pos)) *
+      STOP_TICKS_PER_SECOND + (STOP_PREDIV_S - ss);
+}
+
+static uint32_t StopTicksSince(uint32_t start) {
+   return (StopTicks() + STOP_TICKS_PER_MINUTE - start) % STOP_TICKS_PER_MINUTE;
+}
+
+/*
+ * Wait for the next tick to start.
+ */
+static uint32_t StopTickEdge(void) {
+   uint32_t const last = StopTicks();
+   uint32_t now;
+
+   while((now = StopTicks()) == last) { }
+   return now;
+}
+
+/*
+ * Stop leaves the PLL off and the core on the HSI. Everything else about
+ * the clocks is as platformHW_SetClock() left it, so if we were on the PLL
+ * just turn it back on and switch over, without going through HAL.
+ */
+static void StopRestoreClock(void) {
+   if(!ClockFast) {
+      return;
+   }
+   RCC->CR |= RCC_CR_PLLON;
+   while(!(RCC->CR & RCC_CR_PLLRDY)) { }
+
+   RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | RCC_CFGR_SW_PLL;
+   while((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL) { }
+}
+#endif
+
+/*
+ * Fill everything between .bss and a little below where the stack is now, so
+ * platformHW_StackFree() can tell how deep it's been.
+ */
+static void PaintStack(void) {
+   uint32_t * const end = (uint32_t *)__get_MSP() - STACK_PAINT_MARGIN_WORDS;
+
+   for(uint32_t *p = &_ebss; p < end; p++) {
+      *p = STACK_PAINT;
    }
 }
 
@@ -155,28 +780,22 @@ static void MX_GPIO_Init(void)
    HAL_NVIC_EnableIRQ(EXTI0_1_IRQn);
 }
 
-/* SPI1 init function */
+/*
+ * SPI1 init function. Master, mode 0, MSB first, 8 bits, software NSS; sent
+ * to with SpiWrite().
+ */
 bool platformHW_SpiInit(SPI_HandleTypeDef * const spi, SPI_TypeDef* spiInstance)
 {
    spi->Instance = spiInstance;
-   spi->Init.Mode = SPI_MODE_MASTER;
-   spi->Init.Direction = SPI_DIRECTION_2LINES;
-   spi->Init.DataSize = SPI_DATASIZE_8BIT;
-   spi->Init.CLKPolarity = SPI_POLARITY_LOW;
-   spi->Init.CLKPhase = SPI_PHASE_1EDGE;
-   spi->Init.NSS = SPI_NSS_SOFT;
-   //spi->Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_8;
-   spi->Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_16; //for crappy saelae
-   spi->Init.FirstBit = SPI_FIRSTBIT_MSB;
-   spi->Init.TIMode = SPI_TIMODE_DISABLE;
-   spi->Init.CRCCalculation = SPI_CRCCALCULATION_DISABLE;
-   spi->Init.CRCPolynomial = 7;
-   spi->Init.CRCLength = SPI_CRC_LENGTH_DATASIZE;
-   spi->Init.NSSPMode = SPI_NSS_PULSE_ENABLE;
-   if (HAL_SPI_Init(spi) != HAL_OK)
-   {
-      return false;
-   }
+   // Clock and pins, as HAL_SPI_Init() would have
+   HAL_SPI_MspInit(spi);
+
+   spiInstance->CR1 = 0;
+   spiInstance->CR2 = SPI_CR2_FRXTH | (7 << SPI_CR2_DS_Pos);
+   //for crappy saelae
+   spiInstance->CR1 = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI | SpiPrescaler(HAL_RCC_GetPCLK1Freq());
+   spiInstance->CR1 |= SPI_CR1_SPE;
+
    return true;
 }
 
@@ -188,9 +807,9 @@ bool platformHW_SpiInit(SPI_HandleTypeDef * const spi, SPI_TypeDef* spiInstance)
 void Error_Handler(void)
 {
    //TODO add error logging
-   iprintf("\r\n\r\n");
-   iprintf("ERROR!");
-   iprintf("\r\n\r\n");
+   LOG_ERROR("\r\n\r\n");
+   LOG_ERROR("ERROR!");
+   LOG_ERROR("\r\n\r\n");
    while(1) { }
    /* USER CODE END Error_Handler */ 
 }
@@ -0,0 +1,234 @@
+/*
+ * See power.h. The ADC is only on for the ~100us a measurement takes, and
+ * VREFINT with it.
+ */
+#include "power.h"
+#include "platform_hw.h"
+#include "pattern.h"
+#include "beacons.h"
+#include "led.h"
+#include "metrics.h"
+#include "log.h"
+#include "utilities.h"
+#include "stm32f0xx_hal.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Measure (and maybe change level) this often
+#define POWER_PERIOD_US          (10000000)
+// VREFINT as read at the factory with VDDA at 3.3V
+#define POWER_VREFINT_CAL        (*(uint16_t const *)0x1FFFF7BA)
+#define POWER_VREFINT_CAL_MV     (3300)
+// VREFINT takes this long to settle once it's switched on
+#define POWER_VREFINT_START_US   (10)
+
+// The boost gives 3.3V while it can. Below these it can't, and needs to come
+// back up a little further to count as recovered.
+#define POWER_LOW_MV             (3150)
+#define POWER_CRITICAL_MV        (2950)
+#define POWER_HYSTERESIS_MV      (50)
+// Nobody heard for this long
+#define POWER_ALONE_MS           (10 * 60 * 1000)
+
+// The model, in uA from VDD. Rough: datasheet typicals, nothing measured.
+#define POWER_RUN_FAST_UA        (12000)
+#define POWER_RUN_SLOW_UA        (3000)
+#define POWER_WFI_FAST_UA        (4000)
+#define POWER_WFI_SLOW_UA        (1200)
+#define POWER_STOP_UA            (30)
+// Taken from the cell for each uA at VDD, in %: 3.3V from ~1.25V, ~80%
+// efficient
+#define POWER_BOOST_PCT          (330)
+// An alkaline AAA, at these currents
+#define POWER_CAPACITY_UAS       (1000UL * 3600 * 1000)
+
+struct power_Setting {
+   // % of the pattern's own value
+   uint8_t  brightness;
+   // LED frame interval, times
+   uint8_t  frameStretch;
+   // send one beacon per this many beacon clock ticks
+   uint8_t  beaconEvery;
+   // most the LEDs may draw, mA (see platformHW_SetLEDBudget())
+   uint8_t  ledBudgetMA;
+};
+
+static struct power_Setting const Settings[PL_Count] = {
+   [PL_Normal]    = {.brightness = 100, .frameStretch = 1, .beaconEvery = 1, .ledBudgetMA = 60},
+   [PL_Alone]     = {.brightness = 60,  .frameStretch = 2, .beaconEvery = 2, .ledBudgetMA = 60},
+   [PL_Low]       = {.brightness = 40,  .frameStretch = 2, .beaconEvery = 2, .ledBudgetMA = 30},
+   [PL_Critical]  = {.brightness = 15,  .frameStretch = 4, .beaconEvery = 4, .ledBudgetMA = 15},
+};
+
+static struct power_State {
+   enum power_Level  level;
+   uint32_t          lastUS;
+   uint32_t          lastMS;
+   uint32_t          lastSleepMS;
+   // smoothed, so LED load doesn't flip the level back and forth
+   uint32_t          vddMV;
+   // from the cell, smoothed
+   uint32_t          averageUA;
+   // since boot, which assumes the cell was fresh then
+   uint32_t          usedUAS;
+} state;
+
+static uint32_t power_MeasureVDD(void);
+static uint32_t power_EstimateUA(uint32_t elapsedMS, uint32_t sleptMS);
+static enum power_Level power_PickLevel(void);
+static void power_Apply(enum power_Level level);
+
+/*
+ * Calibrate the ADC and take a first reading. The ADC runs off PCLK/4, which
+ * keeps it in spec at either clock.
+ */
+void power_Init(void) {
+   __HAL_RCC_ADC1_CLK_ENABLE();
+
+   ADC1->CFGR2 = ADC_CFGR2_CKMODE_1;
+   ADC1->CR = ADC_CR_ADCAL;
+   while(ADC1->CR & ADC_CR_ADCAL) { }
+
+   // VREFINT wants at least 4us of sampling, this is ~20us at 12MHz
+   ADC1->CHSELR = ADC_CHSELR_CHSEL17;
+   ADC1->SMPR = ADC_SMPR_SMP;
+
+   state.level = PL_Normal;
+   state.lastUS = platformHW_GetMicros();
+   state.lastMS = HAL_GetTick();
+   state.lastSleepMS = metrics_Get(MID_SleepMS);
+   state.vddMV = power_MeasureVDD();
+   state.averageUA = 0;
+   state.usedUAS = 0;
+
+   metrics_Set(MID_VddMV, state.vddMV);
+   power_Apply(PL_Normal);
+}
+
+/*
+ * Call from the main loop. Does nothing but between periods.
+ */
+void power_GiveTime(uint32_t systimeUS) {
+   uint32_t const nowMS = HAL_GetTick();
+   uint32_t const sleepMS = metrics_Get(MID_SleepMS);
+   enum power_Level level;
+   uint32_t ua;
+
+   if(systimeUS - state.lastUS < POWER_PERIOD_US) {
+      return;
+   }
+   state.lastUS = systimeUS;
+
+   state.vddMV = (3 * state.vddMV + power_MeasureVDD()) / 4;
+
+   ua = power_EstimateUA(nowMS - state.lastMS, sleepMS - state.lastSleepMS);
+   state.averageUA = state.averageUA ? (7 * state.averageUA + ua) / 8 : ua;
+   state.usedUAS = MIN(POWER_CAPACITY_UAS, state.usedUAS + (ua * (nowMS - state.lastMS)) / 1000);
+   state.lastMS = nowMS;
+   state.lastSleepMS = sleepMS;
+
+   level = power_PickLevel();
+   if(level != state.level) {
+      power_Apply(level);
+   }
+
+   metrics_Set(MID_VddMV, state.vddMV);
+   metrics_Set(MID_BatteryUA, state.averageUA);
+   // Once VDD's sagging the model's beside the point: the cell is all but gone
+   if(state.level == PL_Critical) {
+      metrics_Set(MID_RuntimeMin, 0);
+   }
+   else if(state.averageUA) {
+      metrics_Set(MID_RuntimeMin, (POWER_CAPACITY_UAS - state.usedUAS) / state.averageUA / 60);
+   }
+}
+
+enum power_Level power_GetLevel(void) {
+   return state.level;
+}
+
+/*
+ * VDD in mV, from what VREFINT reads as against it.
+ */
+static uint32_t power_MeasureVDD(void) {
+   uint32_t start, raw;
+
+   ADC1_COMMON->CCR |= ADC_CCR_VREFEN;
+   start = platformHW_GetMicros();
+   while(platformHW_GetMicros() - start < POWER_VREFINT_START_US) { }
+
+   ADC1->ISR = ADC_ISR_ADRDY;
+   ADC1->CR |= ADC_CR_ADEN;
+   while(!(ADC1->ISR & ADC_ISR_ADRDY)) { }
+
+   ADC1->CR |= ADC_CR_ADSTART;
+   while(!(ADC1->ISR & ADC_ISR_EOC)) { }
+   raw = ADC1->DR;
+
+   ADC1->CR |= ADC_CR_ADDIS;
+   while(ADC1->CR & ADC_CR_ADEN) { }
+   ADC1_COMMON->CCR &= ~ADC_CCR_VREFEN;
+
+   return raw ? (POWER_VREFINT_CAL_MV * POWER_VREFINT_CAL) / raw : 0;
+}
+
+/*
+ * What we've been taking from the cell, on average, given how long we slept
+ * and what the LEDs draw now.
+ */
+static uint32_t power_EstimateUA(uint32_t elapsedMS, uint32_t sleptMS) {
+   struct pattern_Status status;
+   bool const fast = platformHW_IsClockFast();
+   uint32_t awakeMS, sleepUA, ua;
+
+   if(elapsedMS == 0) {
+      return state.averageUA;
+   }
+   sleptMS = MIN(sleptMS, elapsedMS);
+   awakeMS = elapsedMS - sleptMS;
+
+   // Stop mode's allowed alone (see main.c), and taken most of the time
+   pattern_GetStatus(&status);
+   sleepUA = fast ? POWER_WFI_FAST_UA : POWER_WFI_SLOW_UA;
+#ifdef STOP_MODE_ENABLED
+   if(status.neighbors == 0) {
+      sleepUA = POWER_STOP_UA;
+   }
+#endif
+   ua = ((awakeMS * (fast ? POWER_RUN_FAST_UA : POWER_RUN_SLOW_UA)) + (sleptMS * sleepUA)) / elapsedMS;
+   ua += platformHW_GetLEDCurrentUA();
+
+   return (ua * POWER_BOOST_PCT) / 100;
+}
+
+static enum power_Level power_PickLevel(void) {
+   uint32_t const heardMS = HAL_GetTick() - beacon_LastReceived();
+   // Only down a level as VDD falls, up again once it's clear of the line
+   uint32_t const margin = (state.level >= PL_Low) ? POWER_HYSTERESIS_MV : 0;
+
+   if(state.vddMV < POWER_CRITICAL_MV + ((state.level == PL_Critical) ? margin : 0)) {
+      return PL_Critical;
+   }
+   if(state.vddMV < POWER_LOW_MV + margin) {
+      return PL_Low;
+   }
+   if(heardMS > POWER_ALONE_MS) {
+      return PL_Alone;
+   }
+   return PL_Normal;
+}
+
+static void power_Apply(enum power_Level level) {
+   struct power_Setting const * const s = &Settings[level];
+
+   LOG_INFO("Power level %d (%d mV)\r\n", level, (int)state.vddMV);
+
+   state.level = level;
+   metrics_Set(MID_PowerLevel, level);
+
+   platformHW_SetLEDBrightness(s->brightness);
+   led_SetFrameStretch(s->frameStretch);
+   pattern_SetBeaconEvery(s->beaconEvery);
+   platformHW_SetLEDBudget(s->ledBudgetMA * 1000);
+}
@@ -0,0 +1,65 @@
+/*
+ * See profile.h. Buckets are 16 bit and stick at the top, so ask often enough
+ * (every minute or so) that the hottest one doesn't fill up.
+ */
+#include "profile.h"
+#include "iprintf.h"
+#include "stm32f0xx_hal.h"
+
+#include <stdint.h>
+
+#ifdef PROFILE_ENABLED
+
+#if defined(STM32F051x8)
+#define PROFILE_FLASH_SIZE       (64 * 1024)
+#else
+#define PROFILE_FLASH_SIZE       (32 * 1024)
+#endif
+
+// 128 byte buckets, 512 bytes of RAM for 32KB of flash
+#define PROFILE_BUCKET_SHIFT     (7)
+#define PROFILE_BUCKETS          (PROFILE_FLASH_SIZE >> PROFILE_BUCKET_SHIFT)
+
+static struct profile_State {
+   uint16_t buckets[PROFILE_BUCKETS];
+   uint32_t samples;
+   // not in flash (RAM functions, if we ever have them)
+   uint32_t other;
+} state;
+
+/*
+ * From SysTick, with the interrupted PC.
+ */
+void profile_Sample(uint32_t pc) {
+   uint32_t const offset = pc - FLASH_BASE;
+
+   state.samples++;
+   if(offset >= PROFILE_FLASH_SIZE) {
+      state.other++;
+      return;
+   }
+   if(state.buckets[offset >> PROFILE_BUCKET_SHIFT] != UINT16_MAX) {
+      state.buckets[offset >> PROFILE_BUCKET_SHIFT]++;
+   }
+}
+
+/*
+ * The histogram so far, then start over. Only the buckets that saw anything.
+ */
+void profile_Report(void) {
+   iprintf("PROFILE base=%x shift=%d samples=%d other=%d\r\n", (unsigned)FLASH_BASE,
+         PROFILE_BUCKET_SHIFT, (int)state.samples, (int)state.other);
+
+   for(int i = 0; i < PROFILE_BUCKETS; i++) {
+      if(state.buckets[i] != 0) {
+         iprintf("PROF %d %d\r\n", i, state.buckets[i]);
+         state.buckets[i] = 0;
+      }
+   }
+
+   iprintf("PROFILE end\r\n");
+   state.samples = 0;
+   state.other = 0;
+}
+
+#endif
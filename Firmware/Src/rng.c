@@ -0,0 +1,52 @@
+/*
+ * See rng.h. Marsaglia's xorshift32 (13, 17, 5), period 2^32 - 1.
+ */
+#include "rng.h"
+
+#include <stdint.h>
+
+// Anything but 0, which xorshift never leaves
+#define RNG_DEFAULT_SEED      (2463534242UL)
+
+static struct rng_State {
+   uint32_t x;
+} state = {.x = RNG_DEFAULT_SEED};
+
+/*
+ * Seeds that differ in a bit or two (IDs, counters) would start out alike, so
+ * they're mixed first with murmur3's finalizer.
+ */
+void rng_Seed(uint32_t seed) {
+   seed ^= seed >> 16;
+   seed *= 0x85EBCA6B;
+   seed ^= seed >> 13;
+   seed *= 0xC2B2AE35;
+   seed ^= seed >> 16;
+
+   state.x = seed ? seed : RNG_DEFAULT_SEED;
+}
+
+uint32_t rng_Next(void) {
+   uint32_t x = state.x;
+
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   state.x = x;
+
+   return x;
+}
+
+/*
+ * [0, range), from the top bits, the good ones. Up to 2^16 it's a single 32
+ * bit multiply, biased by at most range / 2^16; the bigger ranges nobody asks
+ * for take a 64 bit one. 0 for a range of 0.
+ */
+uint32_t rng_Below(uint32_t range) {
+   uint32_t const x = rng_Next();
+
+   if(range <= 0x10000) {
+      return ((x >> 16) * range) >> 16;
+   }
+   return ((uint64_t)x * range) >> 32;
+}
@@ -71,6 +71,10 @@ void HAL_UART_MspInit(UART_HandleTypeDef* huart)
     GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
     GPIO_InitStruct.Alternate = GPIO_AF1_USART1;
     HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
+
+    /* Lowest priority, logging waits for everything else */
+    HAL_NVIC_SetPriority(USART1_IRQn, 3, 0);
+    HAL_NVIC_EnableIRQ(USART1_IRQn);
   }
 }
 
@@ -80,6 +84,7 @@ void HAL_UART_MspDeInit(UART_HandleTypeDef* huart)
   {
     /* Peripheral clock disable */
     __HAL_RCC_USART1_CLK_DISABLE();
+    HAL_NVIC_DisableIRQ(USART1_IRQn);
   
     /**USART2 GPIO Configuration
     PA2     ------> USART2_TX
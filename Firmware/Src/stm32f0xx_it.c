@@ -7,10 +7,18 @@
 #include "stm32f0xx_hal_tim.h"
 #include "stm32f0xx_hal_tim_ex.h"
 
+#include "platform_hw.h"
 #include "ir_encode.h"
 #include "ir_decode.h"
+#include "ir_capture.h"
 
 #include "iprintf.h"
+#include "log.h"
+#include "metrics.h"
+#include "timing.h"
+#include "profile.h"
+#include "pattern.h"
+#include "events.h"
 
 
 //TODO find a better way to pass these in
@@ -24,29 +32,83 @@ static uint8_t pol;
 /**
  * @brief This function handles System tick timer.
  */
-void SysTick_Handler(void)
+static void SysTick_Tick(void)
 {
+   metrics_Count(MID_ISRSysTick);
    HAL_IncTick();
    HAL_SYSTICK_IRQHandler();
 }
 
+#ifdef PROFILE_ENABLED
+/*
+ * Hands the exception frame the core just stacked to SysTick_Sampled(), which
+ * returns from the exception for us. Everything runs on the main stack.
+ */
+__attribute__((naked)) void SysTick_Handler(void)
+{
+   __asm volatile(
+      "mrs r0, msp\n"
+      "ldr r1, =SysTick_Sampled\n"
+      "bx r1\n"
+   );
+}
+
+/*
+ * The frame is r0-r3, r12, lr, then the PC we interrupted.
+ */
+__attribute__((used)) void SysTick_Sampled(uint32_t const *frame)
+{
+   profile_Sample(frame[6]);
+   SysTick_Tick();
+}
+#else
+void SysTick_Handler(void)
+{
+   SysTick_Tick();
+}
+#endif
+
 /*
  * Handle any EXTI0 events (IE all GPIO Pin 0's)
  */
 void EXTI0_1_IRQHandler(void) {
+   metrics_Count(MID_ISRButton);
    if(__HAL_GPIO_EXTI_GET_IT(GPIO_PIN_0)) {
       __HAL_GPIO_EXTI_CLEAR_IT(GPIO_PIN_0);
-      iprintf("EXTI on pin 0 (button is %d)", HAL_GPIO_ReadPin(GPIOA, GPIO_PIN_0));
+      LOG_DEBUG("EXTI on pin 0 (button is %d)", HAL_GPIO_ReadPin(GPIOA, GPIO_PIN_0));
 
-      //TODO forward this event somewhere
+      pattern_ButtonPressed();
+      events_Post(EV_Button);
    }
 }
 
+/*
+ * USART1 is only used for iprintf() output, and requests in.
+ */
+void USART1_IRQHandler(void)
+{
+   metrics_Count(MID_ISRUart);
+   iprintf_UartISR();
+}
+
+#ifdef TIMING_ENABLED
+/*
+ * TIM14 is timing.h's clock, and only wraps.
+ */
+void TIM14_IRQHandler(void)
+{
+   timing_Overflow();
+}
+#endif
+
 /*
  * Handle the bit clock ISR for sending IR.
  */
 void TIM16_IRQHandler(void)
 {
+   TIMING_SCOPE(TS_IRTxISR);
+   metrics_Count(MID_ISRIRTx);
+
    //figure out the next stage of the outgoing signal
    ir_SignalGenerate();
 
@@ -59,28 +121,35 @@ void TIM16_IRQHandler(void)
  */
 void TIM3_IRQHandler(void)
 {
-   /* Clear the TIM2 Update pending bit (but doesn't clear the flag)*/
-   __HAL_TIM_CLEAR_IT(&htim3, TIM_FLAG_UPDATE);
+   TIMING_SCOPE(TS_IRRxISR);
+   metrics_Count(MID_ISRIRRx);
+
+   // Read once, and clear only what's handled below
+   uint32_t const sr = htim3.Instance->SR;
 
-   // track the time between ALL edges of the incoming signal.
-   if(__HAL_TIM_GET_FLAG(&htim3, TIM_FLAG_CC1))
+   // track the time between ALL edges of the incoming signal. The edge resets
+   // the counter (slave reset mode), which raises an update as well: that one
+   // belongs to the edge, so it goes too.
+   if(sr & TIM_FLAG_CC1)
    {
-      __HAL_TIM_CLEAR_FLAG(&htim3, TIM_FLAG_CC1);
+      __HAL_TIM_CLEAR_FLAG(&htim3, TIM_FLAG_CC1 | TIM_FLAG_UPDATE);
 
-      ICValue2 = HAL_TIM_ReadCapturedValue(&htim3, TIM_CHANNEL_1);
+      ICValue2 = platformHW_TimCapture(&htim3);
 
       //get current polarity and assume we just saw the opposite edge
       pol = (GPIO_PIN_SET == HAL_GPIO_ReadPin(GPIOA, GPIO_PIN_6));
 
+      ir_CaptureEdge(ICValue2, pol);
       ir_DataSampling(ICValue2, pol);
    }
    //check for IR bit timeout
-   else if(__HAL_TIM_GET_FLAG(&htim3, TIM_FLAG_UPDATE))
+   else if(sr & TIM_FLAG_UPDATE)
    {
       /* Clears the IR_TIM's pending flags*/
       __HAL_TIM_CLEAR_FLAG(&htim3, TIM_FLAG_UPDATE);
 
-      ir_ResetPacket();
+      ir_CaptureTimeout();
+      ir_PacketTimeout();
    }
 }
 
@@ -0,0 +1,110 @@
+/*
+ * See timing.h. TIM14 is only 16 bits, 1.4ms at 48MHz, so its update interrupt
+ * counts the wraps to make a 32 bit clock.
+ */
+#include "timing.h"
+#include "iprintf.h"
+#include "stm32f0xx_hal.h"
+
+#include <stdint.h>
+
+#ifdef TIMING_ENABLED
+
+struct timing_Stats {
+   uint32_t count;
+   uint32_t min;
+   uint32_t max;
+   uint64_t total;
+};
+
+static struct timing_State {
+   volatile uint32_t    overflows;
+   struct timing_Stats  stats[TS_Count];
+} state;
+
+static char const * const Names[TS_Count] = {
+   [TS_PatternGiveTime] = "pattern_GiveTime",
+   [TS_LEDGiveTime]     = "led_GiveTime",
+   [TS_UpdateLEDs]      = "platformHW_UpdateLEDs",
+   [TS_IRRxISR]         = "TIM3_IRQHandler",
+   [TS_IRTxISR]         = "TIM16_IRQHandler",
+};
+
+void timing_Init(void) {
+   for(int i = 0; i < TS_Count; i++) {
+      state.stats[i].count = 0;
+      state.stats[i].min = UINT32_MAX;
+      state.stats[i].max = 0;
+      state.stats[i].total = 0;
+   }
+   state.overflows = 0;
+
+   __HAL_RCC_TIM14_CLK_ENABLE();
+   TIM14->PSC = 0;
+   TIM14->ARR = 0xFFFF;
+   TIM14->EGR = TIM_EGR_UG;
+   TIM14->SR = 0;
+   TIM14->DIER = TIM_DIER_UIE;
+   TIM14->CR1 = TIM_CR1_CEN;
+
+   HAL_NVIC_SetPriority(TIM14_IRQn, 0, 0);
+   HAL_NVIC_EnableIRQ(TIM14_IRQn);
+}
+
+/*
+ * Core clocks since timing_Init(). Fine from ISRs, even ones that are holding
+ * off the wrap interrupt: a wrap that's pending but not counted yet is counted
+ * here.
+ */
+uint32_t timing_Now(void) {
+   uint32_t const primask = __get_PRIMASK();
+   uint32_t high, low;
+
+   __disable_irq();
+   high = state.overflows;
+   low = TIM14->CNT;
+   if(TIM14->SR & TIM_SR_UIF) {
+      // wrapped, maybe after we read it, so read again to be sure which side
+      low = TIM14->CNT;
+      high++;
+   }
+   __set_PRIMASK(primask);
+
+   return (high << 16) | low;
+}
+
+void timing_End(struct timing_Scope const *scope) {
+   uint32_t const cycles = timing_Now() - scope->start;
+   struct timing_Stats * const s = &state.stats[scope->section];
+
+   s->count++;
+   s->total += cycles;
+   if(cycles < s->min) {
+      s->min = cycles;
+   }
+   if(cycles > s->max) {
+      s->max = cycles;
+   }
+}
+
+/*
+ * TIM14's update interrupt.
+ */
+void timing_Overflow(void) {
+   TIM14->SR = ~TIM_SR_UIF;
+   state.overflows++;
+}
+
+/*
+ * A line per section, in core clocks.
+ */
+void timing_Report(void) {
+   for(int i = 0; i < TS_Count; i++) {
+      struct timing_Stats const s = state.stats[i];
+
+      iprintf("TIMING %s n=%d min=%d mean=%d max=%d\r\n", Names[i], (int)s.count,
+            s.count ? (int)s.min : 0, s.count ? (int)(s.total / s.count) : 0, (int)s.max);
+   }
+}
+
+#endif